@@ -0,0 +1,496 @@
+#ifndef CK_VORONOI_CELLINDEX_HPP
+#define CK_VORONOI_CELLINDEX_HPP
+
+#include <vector>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+#include "voronoi.hpp"
+
+//  Range queries over the cells of a built Graph: which cells meet a
+//  rectangle or a polygon.
+//
+//  CellIndex is a packed Hilbert R-tree over the cells' bounds.  The
+//  bounds are sorted along a Hilbert curve through their centres and
+//  packed cellIndexNodeSize to a node, then the nodes likewise up to a
+//  single root, so the tree is built in one sort and never rebalanced.
+//  Neighbouring cells end up in the same nodes, and a query descends only
+//  into nodes whose bounds meet the query's, about log16(cells) levels.
+//
+//  Bounds are those of Graph::cellMetrics() when the graph has them, and
+//  are otherwise found from the half edges.  The cells the tree yields
+//  are then tested against the query region itself: a cell counts if any
+//  part of it, edges included, lies in the region.  For those tests the
+//  index keeps a copy of each cell's corners in leaf order, so a query
+//  reads the tree and the corners it needs in order rather than the
+//  graph's cells and edges scattered in sweep order.  Cells without half
+//  edges (buildStreaming's) count if their bounds meet it; a lone site's
+//  cell has the graph's bounds.
+//
+//  Queries don't change the index, so any number of threads may run them
+//  at once.  For periodic graphs the cells are indexed in their sites'
+//  frames, as getHalfEdgeStartpoint gives them.
+
+namespace cinekine
+{
+    namespace voronoi
+    {
+
+    //  children per node of a CellIndex
+    const int cellIndexNodeSize = 16;
+
+    /**
+     * @class CellIndex
+     * @brief Packed Hilbert R-tree over a Graph's cells, for rectangle and
+     *        polygon range queries
+     *
+     * The index keeps a reference to the graph, which must outlive it.
+     */
+    class CellIndex
+    {
+    public:
+        explicit CellIndex(const Graph& graph);
+
+        const Graph& graph() const { return _graph; }
+
+        //  The cells meeting the rectangle [minX, maxX] x [minY, maxY],
+        //  written to cells (cleared first) in no particular order.
+        void cellsInRect(float minX, float minY, float maxX, float maxY,
+                         std::vector<int>& cells) const;
+
+        //  The cells meeting the simple polygon of count points (either
+        //  winding, not closed by repeating the first point), written to
+        //  cells (cleared first) in no particular order.
+        void cellsInPolygon(const Vertex* points, size_t count,
+                            std::vector<int>& cells) const;
+
+    private:
+        struct Box
+        {
+            float minX, minY, maxX, maxY;
+        };
+
+        //  where a node's bounds lie against a query region
+        enum class Reach
+        {
+            Outside,
+            Crossing,
+            Inside
+        };
+
+        //  Descends into the nodes reach(bounds) finds Crossing.  Cells
+        //  under a node found Inside are all written to cells; visit(leaf)
+        //  decides for a leaf found Crossing.
+        template<typename ReachTest, typename Visit>
+        void search(ReachTest reach, Visit visit,
+                    std::vector<int>& cells) const;
+
+        const Graph& _graph;
+        //  nodes level by level from the leaves (one per cell) up to the
+        //  root, which is last
+        std::vector<Box> _boxes;
+        //  per node, the cell of a leaf or the first child of a parent
+        std::vector<int> _items;
+        //  end of each level's nodes, leaves first
+        std::vector<int> _levelEnds;
+        //  leaf i's cell corners, from its half edges' start points, are
+        //  [_cornerStarts[i], _cornerStarts[i+1]) of _corners
+        std::vector<size_t> _cornerStarts;
+        std::vector<Vertex> _corners;
+    };
+
+    namespace detail
+    {
+        //  position along a Hilbert curve filling a 65536 x 65536 grid
+        inline uint32_t hilbertIndex(uint32_t x, uint32_t y)
+        {
+            const uint32_t n = 1u << 16;
+            uint32_t index = 0;
+            for (uint32_t s = n / 2; s > 0; s /= 2)
+            {
+                const uint32_t rx = (x & s) ? 1 : 0;
+                const uint32_t ry = (y & s) ? 1 : 0;
+                index += s * s * ((3 * rx) ^ ry);
+                if (ry == 0)
+                {
+                    if (rx == 1)
+                    {
+                        x = n - 1 - x;
+                        y = n - 1 - y;
+                    }
+                    std::swap(x, y);
+                }
+            }
+            return index;
+        }
+
+        //  twice the signed area of triangle abc
+        inline double orientation(const Vertex& a, const Vertex& b,
+                                  const Vertex& c)
+        {
+            return ((double)b.x - a.x) * ((double)c.y - a.y) -
+                   ((double)b.y - a.y) * ((double)c.x - a.x);
+        }
+
+        //  whether closed segments ab and cd share a point
+        inline bool segmentsMeet(const Vertex& a, const Vertex& b,
+                                 const Vertex& c, const Vertex& d)
+        {
+            const double o1 = orientation(a, b, c);
+            const double o2 = orientation(a, b, d);
+            const double o3 = orientation(c, d, a);
+            const double o4 = orientation(c, d, b);
+            if (((o1 > 0 && o2 < 0) || (o1 < 0 && o2 > 0)) &&
+                ((o3 > 0 && o4 < 0) || (o3 < 0 && o4 > 0)))
+                return true;
+            //  touching: an end point on the other segment
+            auto within = [](const Vertex& p, const Vertex& q,
+                             const Vertex& r)
+            {
+                return std::min(p.x, q.x) <= r.x &&
+                       r.x <= std::max(p.x, q.x) &&
+                       std::min(p.y, q.y) <= r.y &&
+                       r.y <= std::max(p.y, q.y);
+            };
+            return (o1 == 0 && within(a, b, c)) ||
+                   (o2 == 0 && within(a, b, d)) ||
+                   (o3 == 0 && within(c, d, a)) ||
+                   (o4 == 0 && within(c, d, b));
+        }
+
+        //  whether closed segment ab meets the rectangle, clipping it to
+        //  each side in turn (Liang-Barsky)
+        inline bool segmentMeetsRect(const Vertex& a, const Vertex& b,
+                                     float minX, float minY,
+                                     float maxX, float maxY)
+        {
+            if (std::max(a.x, b.x) < minX || maxX < std::min(a.x, b.x) ||
+                std::max(a.y, b.y) < minY || maxY < std::min(a.y, b.y))
+                return false;
+            const double dx = (double)b.x - a.x;
+            const double dy = (double)b.y - a.y;
+            const double p[4] = { -dx, dx, -dy, dy };
+            const double q[4] = { (double)a.x - minX, (double)maxX - a.x,
+                                  (double)a.y - minY, (double)maxY - a.y };
+            double t0 = 0.0, t1 = 1.0;
+            for (int side = 0; side < 4; ++side)
+            {
+                if (p[side] == 0.0)
+                {
+                    if (q[side] < 0.0)
+                        return false;
+                    continue;
+                }
+                const double t = q[side] / p[side];
+                if (p[side] < 0.0)
+                    t0 = std::max(t0, t);
+                else
+                    t1 = std::min(t1, t);
+                if (t0 > t1)
+                    return false;
+            }
+            return true;
+        }
+
+        //  even-odd test of (x, y) against the polygon of count points
+        inline bool pointInPolygon(const Vertex* points, size_t count,
+                                   float x, float y)
+        {
+            bool inside = false;
+            for (size_t i = 0, j = count - 1; i < count; j = i++)
+            {
+                const Vertex& a = points[j];
+                const Vertex& b = points[i];
+                if ((a.y > y) != (b.y > y))
+                {
+                    const double crossing = a.x + ((double)y - a.y) *
+                                            ((double)b.x - a.x) /
+                                            ((double)b.y - a.y);
+                    if (x < crossing)
+                        inside = !inside;
+                }
+            }
+            return inside;
+        }
+    }
+
+    inline CellIndex::CellIndex(const Graph& graph) :
+        _graph(graph)
+    {
+        const Cells& cells = graph.cells();
+        const int cellCount = (int)cells.size();
+        if (!cellCount)
+            return;
+
+        //  each cell's bounds, and their centres' extent
+        std::vector<Box> bounds(cellCount);
+        const CellMetrics& metrics = graph.cellMetrics();
+        const bool measured = metrics.minX.size() == cells.size();
+        for (int cell = 0; cell < cellCount; ++cell)
+        {
+            Box& box = bounds[cell];
+            if (measured)
+            {
+                box.minX = metrics.minX[cell];
+                box.minY = metrics.minY[cell];
+                box.maxX = metrics.maxX[cell];
+                box.maxY = metrics.maxY[cell];
+                continue;
+            }
+            const HalfEdges& halfEdges = cells[cell].halfEdges;
+            if (halfEdges.empty())
+            {
+                const Vertex site = graph.sitePosition(cells[cell].site);
+                box.minX = box.maxX = site.x;
+                box.minY = box.maxY = site.y;
+                continue;
+            }
+            box.minX = box.minY = std::numeric_limits<float>::max();
+            box.maxX = box.maxY = -std::numeric_limits<float>::max();
+            for (auto& halfEdge : halfEdges)
+            {
+                const Vertex v = graph.getHalfEdgeStartpoint(halfEdge);
+                box.minX = std::min(box.minX, v.x);
+                box.minY = std::min(box.minY, v.y);
+                box.maxX = std::max(box.maxX, v.x);
+                box.maxY = std::max(box.maxY, v.y);
+            }
+        }
+        //  a lone site's cell has no edges but covers the bounds
+        if (cellCount == 1 && cells[0].halfEdges.empty())
+        {
+            const Box all = { 0.0f, 0.0f, graph.xBound(), graph.yBound() };
+            bounds[0] = all;
+        }
+        float minX = std::numeric_limits<float>::max(), minY = minX;
+        float maxX = -minX, maxY = -minX;
+        for (const Box& box : bounds)
+        {
+            const float x = (box.minX + box.maxX) * 0.5f;
+            const float y = (box.minY + box.maxY) * 0.5f;
+            minX = std::min(minX, x);
+            minY = std::min(minY, y);
+            maxX = std::max(maxX, x);
+            maxY = std::max(maxY, y);
+        }
+
+        //  leaves in Hilbert order of their centres, ties by cell
+        const double scaleX = maxX > minX ? 65535.0 / (maxX - minX) : 0.0;
+        const double scaleY = maxY > minY ? 65535.0 / (maxY - minY) : 0.0;
+        std::vector<uint64_t> keys(cellCount);
+        for (int cell = 0; cell < cellCount; ++cell)
+        {
+            const Box& box = bounds[cell];
+            const double x = (box.minX + box.maxX) * 0.5 - minX;
+            const double y = (box.minY + box.maxY) * 0.5 - minY;
+            const uint32_t hilbert =
+                detail::hilbertIndex((uint32_t)(x * scaleX),
+                                     (uint32_t)(y * scaleY));
+            keys[cell] = (uint64_t)hilbert << 32 | (uint32_t)cell;
+        }
+        std::sort(keys.begin(), keys.end());
+
+        size_t nodeCount = cellCount;
+        for (size_t level = cellCount; level > 1; )
+        {
+            level = (level + cellIndexNodeSize - 1) / cellIndexNodeSize;
+            nodeCount += level;
+        }
+        if (cellCount == 1)
+            ++nodeCount;
+        _boxes.reserve(nodeCount);
+        _items.reserve(nodeCount);
+        _cornerStarts.reserve(cellCount + 1);
+        for (int i = 0; i < cellCount; ++i)
+        {
+            const int cell = (int)(uint32_t)keys[i];
+            _boxes.push_back(bounds[cell]);
+            _items.push_back(cell);
+            _cornerStarts.push_back(_corners.size());
+            for (auto& halfEdge : cells[cell].halfEdges)
+                _corners.push_back(graph.getHalfEdgeStartpoint(halfEdge));
+        }
+        _cornerStarts.push_back(_corners.size());
+        _levelEnds.push_back(cellCount);
+
+        //  then each level's nodes packed into parents, up to a root
+        //  above even a single leaf
+        int levelStart = 0;
+        do
+        {
+            const int levelEnd = _levelEnds.back();
+            for (int first = levelStart; first < levelEnd;
+                 first += cellIndexNodeSize)
+            {
+                const int last = std::min(first + cellIndexNodeSize,
+                                          levelEnd);
+                Box box = _boxes[first];
+                for (int child = first + 1; child < last; ++child)
+                {
+                    const Box& other = _boxes[child];
+                    box.minX = std::min(box.minX, other.minX);
+                    box.minY = std::min(box.minY, other.minY);
+                    box.maxX = std::max(box.maxX, other.maxX);
+                    box.maxY = std::max(box.maxY, other.maxY);
+                }
+                _boxes.push_back(box);
+                _items.push_back(first);
+            }
+            levelStart = levelEnd;
+            _levelEnds.push_back((int)_boxes.size());
+        }
+        while (_levelEnds.back() - levelStart > 1);
+    }
+
+    template<typename ReachTest, typename Visit>
+    void CellIndex::search(ReachTest reach, Visit visit,
+                           std::vector<int>& cells) const
+    {
+        if (_boxes.empty())
+            return;
+
+        //  depth first; each level adds at most a node's children
+        int stack[cellIndexNodeSize * 32];
+        int depth = 0;
+        stack[depth++] = (int)_boxes.size() - 1;
+        const int leafEnd = _levelEnds[0];
+        while (depth)
+        {
+            const int node = stack[--depth];
+            const int level = (int)(std::upper_bound(_levelEnds.begin(),
+                                                     _levelEnds.end(),
+                                                     node) -
+                                    _levelEnds.begin());
+            const Reach where = reach(_boxes[node]);
+            if (where == Reach::Outside)
+                continue;
+            if (node < leafEnd)
+            {
+                if (where == Reach::Inside || visit(node))
+                    cells.push_back(_items[node]);
+                continue;
+            }
+            if (where == Reach::Inside)
+            {
+                //  a node at level l holds the leaves of its place in the
+                //  level times cellIndexNodeSize^l
+                size_t span = 1;
+                for (int l = 0; l < level; ++l)
+                    span *= cellIndexNodeSize;
+                const size_t place = node - _levelEnds[level - 1];
+                const size_t last = std::min((place + 1) * span,
+                                             (size_t)leafEnd);
+                for (size_t leaf = place * span; leaf < last; ++leaf)
+                    cells.push_back(_items[leaf]);
+                continue;
+            }
+            const int first = _items[node];
+            const int last = std::min(first + cellIndexNodeSize,
+                                      _levelEnds[level - 1]);
+            for (int child = first; child < last; ++child)
+                stack[depth++] = child;
+        }
+    }
+
+    inline void CellIndex::cellsInRect(float minX, float minY,
+                                       float maxX, float maxY,
+                                       std::vector<int>& cells) const
+    {
+        cells.clear();
+        auto reach = [=](const Box& box)
+        {
+            if (box.maxX < minX || maxX < box.minX ||
+                box.maxY < minY || maxY < box.minY)
+                return Reach::Outside;
+            if (minX <= box.minX && box.maxX <= maxX &&
+                minY <= box.minY && box.maxY <= maxY)
+                return Reach::Inside;
+            return Reach::Crossing;
+        };
+        search(reach, [&](int leaf)
+        {
+            const Vertex* corners = _corners.data() + _cornerStarts[leaf];
+            const size_t count = _cornerStarts[leaf + 1] -
+                                 _cornerStarts[leaf];
+            //  known only by its bounds
+            if (!count)
+                return true;
+            //  a side in the rectangle, or else the rectangle wholly
+            //  inside the cell
+            for (size_t i = 0, j = count - 1; i < count; j = i++)
+            {
+                if (detail::segmentMeetsRect(corners[j], corners[i],
+                                             minX, minY, maxX, maxY))
+                    return true;
+            }
+            return detail::pointInPolygon(corners, count, minX, minY);
+        }, cells);
+    }
+
+    inline void CellIndex::cellsInPolygon(const Vertex* points, size_t count,
+                                          std::vector<int>& cells) const
+    {
+        cells.clear();
+        if (!count)
+            return;
+        Box bounds = { points[0].x, points[0].y, points[0].x, points[0].y };
+        for (size_t i = 1; i < count; ++i)
+        {
+            bounds.minX = std::min(bounds.minX, points[i].x);
+            bounds.minY = std::min(bounds.minY, points[i].y);
+            bounds.maxX = std::max(bounds.maxX, points[i].x);
+            bounds.maxY = std::max(bounds.maxY, points[i].y);
+        }
+        //  bounds no side of the polygon reaches lie wholly inside it or
+        //  wholly outside
+        auto reach = [&](const Box& box)
+        {
+            if (box.maxX < bounds.minX || bounds.maxX < box.minX ||
+                box.maxY < bounds.minY || bounds.maxY < box.minY)
+                return Reach::Outside;
+            for (size_t i = 0, j = count - 1; i < count; j = i++)
+            {
+                if (detail::segmentMeetsRect(points[j], points[i],
+                                             box.minX, box.minY,
+                                             box.maxX, box.maxY))
+                    return Reach::Crossing;
+            }
+            return detail::pointInPolygon(points, count, box.minX,
+                                          box.minY) ?
+                   Reach::Inside : Reach::Outside;
+        };
+        search(reach, [&](int leaf)
+        {
+            const Vertex* corners = _corners.data() + _cornerStarts[leaf];
+            const size_t cornerCount = _cornerStarts[leaf + 1] -
+                                       _cornerStarts[leaf];
+            //  known only by its bounds, which a side reaches
+            if (!cornerCount)
+                return true;
+            const Box& box = _boxes[leaf];
+            for (size_t i = 0, j = count - 1; i < count; j = i++)
+            {
+                if (!detail::segmentMeetsRect(points[j], points[i],
+                                              box.minX, box.minY,
+                                              box.maxX, box.maxY))
+                    continue;
+                for (size_t k = 0, l = cornerCount - 1; k < cornerCount;
+                     l = k++)
+                {
+                    if (detail::segmentsMeet(points[j], points[i],
+                                             corners[l], corners[k]))
+                        return true;
+                }
+            }
+            //  no sides cross, so one holds the other or they're apart
+            return detail::pointInPolygon(points, count,
+                                          corners[0].x, corners[0].y) ||
+                   detail::pointInPolygon(corners, cornerCount,
+                                          points[0].x, points[0].y);
+        }, cells);
+    }
+
+    }   // namespace voronoi
+}   // namespace cinekine
+
+#endif
@@ -0,0 +1,298 @@
+#ifndef CK_VORONOI_INTERPOLATE_HPP
+#define CK_VORONOI_INTERPOLATE_HPP
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "voronoi.hpp"
+#include "neighbors.hpp"
+
+//  Natural neighbour (Sibson) interpolation over a built Graph.
+//
+//  Inserting a query point q would give it a new cell, carved out of the
+//  cells of its natural neighbours; q's Sibson weight for a neighbour is
+//  the share of the new cell taken from that neighbour's cell.  Nothing
+//  is inserted here.  The new cell is the bounding box clipped by the
+//  bisectors of q and the sites around it, found by a breadth-first walk
+//  over the Delaunay adjacency from q's nearest site that only continues
+//  through sites whose bisector still cuts the cell.  Each candidate's
+//  stolen area is then the new cell clipped to the candidate's existing
+//  (convex) cell.  All of it runs in double precision on small polygons
+//  held in per-thread scratch.
+//
+//  The new cell is confined to the graph's bounds like every other cell,
+//  so weights near the bounds follow the clipped diagram.  Query points
+//  outside the bounds, and points that coincide with a site, take their
+//  nearest site's value.
+
+namespace cinekine
+{
+    namespace voronoi
+    {
+
+    /**
+     * @struct NaturalNeighbor
+     * @brief  A site and its Sibson weight for a query point
+     */
+    struct NaturalNeighbor
+    {
+        int site;
+        float weight;
+    };
+
+    /** A natural neighbours container */
+    typedef std::vector<NaturalNeighbor> NaturalNeighbors;
+
+    /**
+     * @class SibsonQuery
+     * @brief Computes Sibson weights against a Graph and a SiteIndex built
+     *        from it, holding the scratch space needed.  One per thread.
+     */
+    class SibsonQuery
+    {
+    public:
+        SibsonQuery(const Graph& graph, const SiteIndex& index);
+
+        //  The natural neighbours of (x, y) and their weights, which sum
+        //  to one.  Returns the nearest site (usable as the next hint) or
+        //  -1 if the graph has no sites.
+        int weights(float x, float y, NaturalNeighbors& neighbors,
+                    int hint = -1);
+
+        //  The interpolated value at (x, y) given one value per site.
+        float interpolate(float x, float y, const float* values,
+                          int* nearest = nullptr, int hint = -1);
+
+    private:
+        struct Point
+        {
+            double x, y;
+        };
+        typedef std::vector<Point> Polygon;
+
+        //  keeps the part of polygon where nx*x + ny*y <= c, returning
+        //  whether anything was cut away
+        static bool clip(Polygon& polygon, Polygon& scratch,
+                         double nx, double ny, double c);
+        static double area(const Polygon& polygon);
+        double stolenArea(int site);
+
+        const Graph& _graph;
+        const SiteIndex& _index;
+        std::vector<unsigned> _visited;
+        unsigned _stamp;
+        std::vector<int> _queue;
+        std::vector<int> _candidates;
+        NaturalNeighbors _neighbors;
+        Polygon _cell;
+        Polygon _stolen;
+        Polygon _scratch;
+    };
+
+    //  Interpolates values (one per site) at count points into results,
+    //  splitting the points across threads.
+    void interpolateBatch(const Graph& graph, const SiteIndex& index,
+                          const float* values,
+                          const Vertex* points, size_t count,
+                          float* results, unsigned threadCount = 1);
+
+    inline SibsonQuery::SibsonQuery(const Graph& graph,
+                                    const SiteIndex& index) :
+        _graph(graph),
+        _index(index),
+        _visited(graph.siteCount(), 0),
+        _stamp(0)
+    {
+    }
+
+    inline bool SibsonQuery::clip(Polygon& polygon, Polygon& scratch,
+                                  double nx, double ny, double c)
+    {
+        bool cut = false;
+        scratch.clear();
+        const size_t count = polygon.size();
+        for (size_t i = 0; i < count; ++i)
+        {
+            const Point& a = polygon[i];
+            const Point& b = polygon[(i + 1) % count];
+            const double da = nx*a.x + ny*a.y - c;
+            const double db = nx*b.x + ny*b.y - c;
+            if (da <= 0.0)
+                scratch.push_back(a);
+            else
+                cut = true;
+            if ((da < 0.0 && db > 0.0) || (da > 0.0 && db < 0.0))
+            {
+                const double t = da / (da - db);
+                Point p = { a.x + t*(b.x - a.x), a.y + t*(b.y - a.y) };
+                scratch.push_back(p);
+            }
+        }
+        polygon.swap(scratch);
+        return cut;
+    }
+
+    inline double SibsonQuery::area(const Polygon& polygon)
+    {
+        double sum = 0.0;
+        const size_t count = polygon.size();
+        for (size_t i = 0; i < count; ++i)
+        {
+            const Point& a = polygon[i];
+            const Point& b = polygon[(i + 1) % count];
+            sum += a.x*b.y - b.x*a.y;
+        }
+        return std::abs(sum) * 0.5;
+    }
+
+    inline double SibsonQuery::stolenArea(int site)
+    {
+        const Vertex origin = _graph.sitePosition(site);
+        const int cell = _graph.siteCell(site);
+        if (cell < 0)
+            return 0.0;
+
+        _stolen = _cell;
+        for (auto& halfEdge : _graph.cells()[cell].halfEdges)
+        {
+            if (_stolen.empty())
+                break;
+            Vertex va = _graph.getHalfEdgeStartpoint(halfEdge);
+            Vertex vb = _graph.getHalfEdgeEndpoint(halfEdge);
+            //  outward normal of the edge: away from the cell's site
+            double nx = (double)vb.y - va.y;
+            double ny = (double)va.x - vb.x;
+            if (nx*(origin.x - va.x) + ny*(origin.y - va.y) > 0.0)
+            {
+                nx = -nx;
+                ny = -ny;
+            }
+            clip(_stolen, _scratch, nx, ny, nx*va.x + ny*va.y);
+        }
+        return _stolen.size() < 3 ? 0.0 : area(_stolen);
+    }
+
+    inline int SibsonQuery::weights(float x, float y,
+                                    NaturalNeighbors& neighbors, int hint)
+    {
+        neighbors.clear();
+        const int nearest = _index.nearestSite(x, y, hint);
+        if (nearest < 0)
+            return -1;
+
+        const Vertex nearestSite = _graph.sitePosition(nearest);
+        const NaturalNeighbor self = { nearest, 1.0f };
+        if (x < 0.0f || x > _graph.xBound() ||
+            y < 0.0f || y > _graph.yBound() ||
+            (nearestSite.x == x && nearestSite.y == y))
+        {
+            neighbors.push_back(self);
+            return nearest;
+        }
+
+        if (++_stamp == 0)
+        {
+            std::fill(_visited.begin(), _visited.end(), 0);
+            _stamp = 1;
+        }
+
+        //  q's cell: the bounds, cut by bisectors of q and the sites
+        //  around it.  A site whose bisector misses the cell can't be a
+        //  natural neighbour, and the natural neighbours are connected
+        //  through each other, so the walk stops at such sites.
+        const double qx = x, qy = y;
+        const double xBound = _graph.xBound(), yBound = _graph.yBound();
+        Point corners[4] = {
+            { 0.0, 0.0 }, { xBound, 0.0 }, { xBound, yBound }, { 0.0, yBound }
+        };
+        _cell.assign(corners, corners + 4);
+
+        _queue.clear();
+        _candidates.clear();
+        _queue.push_back(nearest);
+        _visited[nearest] = _stamp;
+        for (size_t head = 0; head < _queue.size(); ++head)
+        {
+            const int site = _queue[head];
+            const Vertex position = _graph.sitePosition(site);
+            const double sx = position.x, sy = position.y;
+            const double nx = sx - qx, ny = sy - qy;
+            const double c = nx*(sx + qx)*0.5 + ny*(sy + qy)*0.5;
+            if (!clip(_cell, _scratch, nx, ny, c) && site != nearest)
+                continue;
+            _candidates.push_back(site);
+            for (auto neighbor = _index.neighborsBegin(site);
+                 neighbor != _index.neighborsEnd(site); ++neighbor)
+            {
+                if (_visited[*neighbor] != _stamp)
+                {
+                    _visited[*neighbor] = _stamp;
+                    _queue.push_back(*neighbor);
+                }
+            }
+        }
+
+        //  weights relative to the total stolen, rather than q's cell
+        //  area, so they sum to one whatever the rounding
+        double total = 0.0;
+        for (int site : _candidates)
+        {
+            const double stolen = stolenArea(site);
+            if (stolen > 0.0)
+            {
+                NaturalNeighbor neighbor = { site, (float)stolen };
+                neighbors.push_back(neighbor);
+                total += stolen;
+            }
+        }
+        if (total <= 0.0)
+        {
+            neighbors.clear();
+            neighbors.push_back(self);
+            return nearest;
+        }
+        for (auto& neighbor : neighbors)
+            neighbor.weight = (float)(neighbor.weight / total);
+        return nearest;
+    }
+
+    inline float SibsonQuery::interpolate(float x, float y,
+                                          const float* values,
+                                          int* nearest, int hint)
+    {
+        int site = weights(x, y, _neighbors, hint);
+        double value = 0.0;
+        for (auto& neighbor : _neighbors)
+            value += (double)neighbor.weight * values[neighbor.site];
+        if (nearest)
+            *nearest = site;
+        return site < 0 ? std::nanf("") : (float)value;
+    }
+
+    inline void interpolateBatch(const Graph& graph, const SiteIndex& index,
+                                 const float* values,
+                                 const Vertex* points, size_t count,
+                                 float* results, unsigned threadCount)
+    {
+        if (!count)
+            return;
+        threadCount = std::max(1u, std::min<unsigned>(threadCount,
+                                                      (unsigned)count));
+        parallelFor(threadCount, [&](unsigned thread)
+        {
+            SibsonQuery query(graph, index);
+            const size_t begin = count * thread / threadCount;
+            const size_t end = count * (thread + 1) / threadCount;
+            int hint = -1;
+            for (size_t i = begin; i < end; ++i)
+            {
+                results[i] = query.interpolate(points[i].x, points[i].y,
+                                               values, &hint, hint);
+            }
+        });
+    }
+
+    }   // namespace voronoi
+}   // namespace cinekine
+
+#endif
@@ -0,0 +1,813 @@
+#ifndef CK_VORONOI_KINETIC_HPP
+#define CK_VORONOI_KINETIC_HPP
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+#include <queue>
+#include <unordered_map>
+#include "voronoi.hpp"
+#include "predicates.hpp"
+
+//  Kinetic Voronoi diagram of sites moving along straight lines.
+//
+//  The topology is kept as its dual, the Delaunay triangulation, seeded
+//  from the Delaunay edges of a built Graph (see neighbors.hpp) and
+//  closed off with ghost triangles joining each hull edge to a vertex at
+//  infinity.  Every edge carries a certificate: the site across from one
+//  of its triangles lies outside the other's circumcircle or, next to a
+//  ghost, the hull keeps turning the same way.  With positions linear in
+//  time, a certificate is a polynomial in time of degree four (two on the
+//  hull), so the time it first fails is found ahead and queued.
+//  Advancing pops the failures due, flips each failed edge and certifies
+//  the five edges of the two new triangles again.  A frame costs
+//  O(log N) per topological change, and nothing for sites whose
+//  neighbourhood holds.
+//
+//  Failure times are found on the polynomials in double precision, by
+//  bisection between their turning points; a certificate that only
+//  touches zero does not fail.  Constant certificates (the four sites
+//  move together) use the exact predicates, so formations of cocircular
+//  sites never flip back and forth.  Queued failures are invalidated
+//  lazily, by stamps on the triangles they were computed from.
+//
+//  Sites start at the Graph's positions at time zero.  Sites the sweep
+//  dropped as duplicates have no Delaunay neighbours: they move, but stay
+//  out of the triangulation.  Periodic and compacted graphs are not
+//  supported, and without three sites off a line there are no triangles.
+
+namespace cinekine
+{
+    namespace voronoi
+    {
+
+    /**
+     * @struct KineticTriangle
+     * @brief  A Delaunay triangle of a KineticVoronoi
+     *
+     * sites are counterclockwise, -1 standing for the vertex at infinity
+     * of a ghost triangle; adjacent[i] is the triangle across the edge
+     * opposite sites[i].
+     */
+    struct KineticTriangle
+    {
+        int sites[3];
+        int adjacent[3];
+    };
+
+    /** A kinetic triangles container */
+    typedef std::vector<KineticTriangle> KineticTriangles;
+
+    /**
+     * @class KineticVoronoi
+     * @brief Voronoi topology of sites on linear trajectories, updated by
+     *        the edge flips due as time advances
+     */
+    class KineticVoronoi
+    {
+    public:
+        //  The graph's sites at time zero, each moving at its velocity
+        //  (distance per unit of time; sites past the end stand still.)
+        KineticVoronoi(const Graph& graph,
+                       const std::vector<Vertex>& velocities);
+
+        double time() const { return _time; }
+        size_t siteCount() const { return _motions.size(); }
+
+        //  position at time()
+        Vertex sitePosition(int site) const;
+        Vertex siteVelocity(int site) const {
+            return Vertex((float)_motions[site].vx,
+                          (float)_motions[site].vy);
+        }
+
+        //  Moves on to time, applying the flips due on the way in order.
+        //  Earlier times are ignored.
+        void advance(double time);
+
+        //  The site moves at velocity from time() on.
+        void setVelocity(int site, const Vertex& velocity);
+
+        //  Delaunay neighbours of a site, counterclockwise.  found is
+        //  cleared first.
+        void neighbors(int site, std::vector<int>& found) const;
+
+        //  ghosts included; each other triangle is a Voronoi vertex
+        const KineticTriangles& triangles() const { return _triangles; }
+        bool isGhost(int triangle) const;
+        //  circumcentre of a triangle at time(), undefined for ghosts
+        Vertex voronoiVertex(int triangle) const;
+
+        //  flips applied so far
+        uint64_t flipCount() const { return _flipCount; }
+
+    private:
+        struct Motion
+        {
+            double x, y;
+            double vx, vy;
+            double since;
+        };
+
+        struct Event
+        {
+            double time;
+            int triangle, slot, neighbor;
+            unsigned stamp, neighborStamp;
+        };
+
+        struct Later
+        {
+            bool operator()(const Event& a, const Event& b) const {
+                return a.time > b.time;
+            }
+        };
+
+        void position(int site, double& x, double& y) const;
+        //  certificate of the edge opposite slot as a polynomial in the
+        //  time since time(), failing where it rises above zero; returns
+        //  its degree.  exact, if given, gets the certificate's exact sign
+        //  now.
+        int certificate(int triangle, int slot, double* polynomial,
+                        double* exact = nullptr) const;
+        void certify(int triangle, int slot);
+        void flip(int triangle, int slot);
+
+        std::vector<Motion> _motions;
+        KineticTriangles _triangles;
+        std::vector<unsigned> _stamps;
+        //  a triangle of each site, -1 for those outside the triangulation
+        std::vector<int> _siteTriangles;
+        std::priority_queue<Event, std::vector<Event>, Later> _events;
+        std::vector<int> _ring;
+        double _time;
+        uint64_t _flipCount;
+    };
+
+    namespace detail
+    {
+        //  p[0] + p[1]*x + ... + p[degree]*x^degree
+        inline double evaluatePolynomial(const double* p, int degree,
+                                         double x)
+        {
+            double value = p[degree];
+            for (int i = degree; i--; )
+                value = value * x + p[i];
+            return value;
+        }
+
+        //  a point between lo >= 0 and hi: the midpoint, or the geometric
+        //  mean while the bracket spans orders of magnitude
+        inline double splitBracket(double lo, double hi)
+        {
+            const double floor = std::max(lo, 1.0);
+            if (hi > 8.0 * floor)
+                return std::sqrt(floor) * std::sqrt(hi);
+            return 0.5 * (lo + hi);
+        }
+
+        //  the root of p in (lo, hi), where p is monotone, rising or not,
+        //  and changes sign: Newton steps, splitting the bracket instead
+        //  whenever a step leaves it
+        inline double monotoneRoot(const double* p, const double* derivative,
+                                   int degree, double lo, double hi,
+                                   bool rising)
+        {
+            double x = splitBracket(lo, hi);
+            for (int step = 0; step < 100; ++step)
+            {
+                const double value = evaluatePolynomial(p, degree, x);
+                if (value == 0.0)
+                    return x;
+                if ((value < 0.0) == rising)
+                    lo = x;
+                else
+                    hi = x;
+                double next = x - value /
+                    evaluatePolynomial(derivative, degree - 1, x);
+                if (!(next > lo && next < hi))
+                {
+                    next = splitBracket(lo, hi);
+                    if (next <= lo || next >= hi)
+                        return x;
+                }
+                if (std::abs(next - x) <= 1e-15 * std::abs(x))
+                    return next;
+                x = next;
+            }
+            return x;
+        }
+
+        //  the points in (lo, hi) where p (degree at most four) changes
+        //  sign, ascending, into roots; returns how many.  p is monotone
+        //  between its turning points, found the same way on p', so each
+        //  root is searched for within one monotone piece.
+        inline int polynomialRoots(const double* p, int degree,
+                                   double lo, double hi, double* roots)
+        {
+            while (degree > 0 && p[degree] == 0.0)
+                --degree;
+            if (degree == 0)
+                return 0;
+            if (degree == 1)
+            {
+                const double root = -p[0] / p[1];
+                if (!(root > lo && root < hi))
+                    return 0;
+                roots[0] = root;
+                return 1;
+            }
+            if (degree == 2)
+            {
+                const double discriminant = p[1]*p[1] - 4.0*p[2]*p[0];
+                if (discriminant <= 0.0)
+                    return 0;
+                const double q = -0.5 * (p[1] + std::copysign(
+                                             std::sqrt(discriminant), p[1]));
+                double pair[2] = { q / p[2], p[0] / q };
+                if (pair[0] > pair[1])
+                    std::swap(pair[0], pair[1]);
+                int count = 0;
+                for (double root : pair)
+                {
+                    if (root > lo && root < hi)
+                        roots[count++] = root;
+                }
+                return count;
+            }
+
+            double derivative[4];
+            for (int i = 1; i <= degree; ++i)
+                derivative[i - 1] = i * p[i];
+            double ends[5];
+            int endCount = 0;
+            ends[endCount++] = lo;
+            endCount += polynomialRoots(derivative, degree - 1, lo, hi,
+                                        ends + 1);
+            ends[endCount++] = hi;
+
+            int count = 0;
+            double a = lo;
+            double fa = evaluatePolynomial(p, degree, a);
+            for (int e = 1; e < endCount; ++e)
+            {
+                const double b = ends[e];
+                const double fb = evaluatePolynomial(p, degree, b);
+                if ((fa < 0.0 && fb > 0.0) || (fa > 0.0 && fb < 0.0))
+                {
+                    roots[count++] = monotoneRoot(p, derivative, degree,
+                                                  a, b, fa < 0.0);
+                }
+                a = b;
+                fa = fb;
+            }
+            return count;
+        }
+
+        //  The first x >= 0 where p (degree at most four) rises above
+        //  zero, infinity if it never does.  A piece of p that starts
+        //  above zero only fails if p keeps rising, which keeps an edge
+        //  just flipped (its certificate rounding to a hair above zero,
+        //  on the way down) from flipping straight back.
+        inline double firstRise(const double* p, int degree)
+        {
+            const double never = std::numeric_limits<double>::infinity();
+            while (degree > 0 && p[degree] == 0.0)
+                --degree;
+            if (degree == 0)
+                return never;
+            //  no coefficient above zero: p stays at or below zero
+            if (*std::max_element(p, p + degree + 1) <= 0.0)
+                return never;
+
+            //  Cauchy's bound on the roots, kept clear of overflow
+            double bound = 0.0;
+            for (int i = 0; i < degree; ++i)
+                bound = std::max(bound, std::abs(p[i] / p[degree]));
+            bound = std::min(bound + 1.0, 1e30);
+
+            double ends[5];
+            int endCount = 0;
+            ends[endCount++] = 0.0;
+            double derivative[4];
+            for (int i = 1; i <= degree; ++i)
+                derivative[i - 1] = i * p[i];
+            endCount += polynomialRoots(derivative, degree - 1, 0.0, bound,
+                                        ends + 1);
+            ends[endCount++] = bound;
+
+            double a = 0.0;
+            double fa = evaluatePolynomial(p, degree, a);
+            for (int e = 1; e < endCount; ++e)
+            {
+                const double b = ends[e];
+                const double fb = evaluatePolynomial(p, degree, b);
+                if (fb > fa && fb > 0.0)
+                {
+                    if (fa >= 0.0)
+                        return a;
+                    return monotoneRoot(p, derivative, degree, a, b, true);
+                }
+                a = b;
+                fa = fb;
+            }
+            return never;
+        }
+
+        //  q = a * b, for degrees adding up to at most four
+        inline void multiplyPolynomials(const double* a, int aDegree,
+                                        const double* b, int bDegree,
+                                        double* q)
+        {
+            std::fill(q, q + aDegree + bDegree + 1, 0.0);
+            for (int i = 0; i <= aDegree; ++i)
+                for (int j = 0; j <= bDegree; ++j)
+                    q[i + j] += a[i] * b[j];
+        }
+    }
+
+    inline KineticVoronoi::KineticVoronoi(
+            const Graph& graph,
+            const std::vector<Vertex>& velocities) :
+        _time(0.0),
+        _flipCount(0)
+    {
+        const int siteCount = (int)graph.siteCount();
+        _motions.resize(siteCount);
+        for (int site = 0; site < siteCount; ++site)
+        {
+            const Vertex p = graph.sitePosition(site);
+            Motion& motion = _motions[site];
+            motion.x = p.x;
+            motion.y = p.y;
+            motion.vx = site < (int)velocities.size() ?
+                        velocities[site].x : 0.0;
+            motion.vy = site < (int)velocities.size() ?
+                        velocities[site].y : 0.0;
+            motion.since = 0.0;
+        }
+        _siteTriangles.assign(siteCount, -1);
+
+        //  Delaunay adjacency, each site's neighbours counterclockwise
+        std::vector<int> offsets(siteCount + 1, 0);
+        for (auto& edge : graph.edges())
+        {
+            if (edge.leftSite < 0 || edge.rightSite < 0 ||
+                edge.leftSite == edge.rightSite)
+                continue;
+            ++offsets[edge.leftSite + 1];
+            ++offsets[edge.rightSite + 1];
+        }
+        for (int site = 0; site < siteCount; ++site)
+            offsets[site + 1] += offsets[site];
+        std::vector<int> adjacency(offsets[siteCount]);
+        std::vector<int> fill(offsets.begin(), offsets.end() - 1);
+        for (auto& edge : graph.edges())
+        {
+            if (edge.leftSite < 0 || edge.rightSite < 0 ||
+                edge.leftSite == edge.rightSite)
+                continue;
+            adjacency[fill[edge.leftSite]++] = edge.rightSite;
+            adjacency[fill[edge.rightSite]++] = edge.leftSite;
+        }
+        std::vector<double> angles(siteCount);
+        for (int site = 0; site < siteCount; ++site)
+        {
+            int* begin = adjacency.data() + offsets[site];
+            int* end = adjacency.data() + offsets[site + 1];
+            const Motion& origin = _motions[site];
+            for (int* n = begin; n != end; ++n)
+            {
+                angles[*n] = std::atan2(_motions[*n].y - origin.y,
+                                        _motions[*n].x - origin.x);
+            }
+            std::sort(begin, end);
+            end = std::unique(begin, end);
+            std::sort(begin, end, [&angles](int a, int b)
+                      {
+                          return angles[a] < angles[b];
+                      });
+            std::fill(end, adjacency.data() + offsets[site + 1], -1);
+        }
+
+        //  faces, walking each directed edge once with the face on its
+        //  left: after u->v comes v->w, w preceding u around v.  The
+        //  outer face is the one walked clockwise.
+        std::vector<char> walked(adjacency.size(), 0);
+        std::vector<int> faceStarts;
+        std::vector<int> faceSites;
+        std::vector<double> faceAreas;
+        for (int u = 0; u < siteCount; ++u)
+        {
+            for (int k = offsets[u]; k < offsets[u + 1]; ++k)
+            {
+                if (walked[k] || adjacency[k] < 0)
+                    continue;
+                faceStarts.push_back((int)faceSites.size());
+                double area = 0.0;
+                int from = u, at = k;
+                while (!walked[at])
+                {
+                    walked[at] = 1;
+                    const int to = adjacency[at];
+                    faceSites.push_back(from);
+                    area += _motions[from].x * _motions[to].y -
+                            _motions[to].x * _motions[from].y;
+                    int back = offsets[to];
+                    while (adjacency[back] != from)
+                        ++back;
+                    int next = back == offsets[to] ? offsets[to + 1] : back;
+                    do
+                        --next;
+                    while (adjacency[next] < 0);
+                    from = to;
+                    at = next;
+                }
+                faceAreas.push_back(area);
+            }
+        }
+        faceStarts.push_back((int)faceSites.size());
+        const int faceCount = (int)faceAreas.size();
+        if (faceCount < 2)
+            return;
+        const int outer = (int)(std::min_element(faceAreas.begin(),
+                                                 faceAreas.end()) -
+                                faceAreas.begin());
+
+        //  fans over the inner faces (more than three sites only where
+        //  sites are cocircular), ghosts over the outer one's edges
+        auto addTriangle = [this](int a, int b, int c)
+        {
+            KineticTriangle triangle = { { a, b, c }, { -1, -1, -1 } };
+            _triangles.push_back(triangle);
+        };
+        for (int face = 0; face < faceCount; ++face)
+        {
+            const int* sites = faceSites.data() + faceStarts[face];
+            const int count = faceStarts[face + 1] - faceStarts[face];
+            if (face == outer)
+            {
+                for (int i = 0; i < count; ++i)
+                    addTriangle(sites[i], sites[(i + 1) % count], -1);
+            }
+            else
+            {
+                for (int i = 1; i + 1 < count; ++i)
+                    addTriangle(sites[0], sites[i], sites[i + 1]);
+            }
+        }
+
+        //  pair each triangle's edges with their reverses
+        const int triangleCount = (int)_triangles.size();
+        auto key = [siteCount](int from, int to)
+        {
+            return (uint64_t)(from + 1) * (uint64_t)(siteCount + 1) +
+                   (uint64_t)(to + 1);
+        };
+        std::unordered_map<uint64_t, int> slots;
+        slots.reserve(triangleCount * 3);
+        for (int t = 0; t < triangleCount; ++t)
+        {
+            const int* sites = _triangles[t].sites;
+            for (int i = 0; i < 3; ++i)
+                slots[key(sites[(i + 1) % 3], sites[(i + 2) % 3])] = t;
+        }
+        for (int t = 0; t < triangleCount; ++t)
+        {
+            KineticTriangle& triangle = _triangles[t];
+            for (int i = 0; i < 3; ++i)
+            {
+                auto twin = slots.find(key(triangle.sites[(i + 2) % 3],
+                                           triangle.sites[(i + 1) % 3]));
+                if (twin != slots.end())
+                    triangle.adjacent[i] = twin->second;
+            }
+            for (int i = 0; i < 3; ++i)
+            {
+                if (triangle.sites[i] >= 0)
+                    _siteTriangles[triangle.sites[i]] = t;
+            }
+        }
+
+        _stamps.assign(triangleCount, 0);
+        for (int t = 0; t < triangleCount; ++t)
+        {
+            for (int i = 0; i < 3; ++i)
+                certify(t, i);
+        }
+    }
+
+    inline void KineticVoronoi::position(int site, double& x,
+                                         double& y) const
+    {
+        const Motion& motion = _motions[site];
+        const double elapsed = _time - motion.since;
+        x = motion.x + motion.vx * elapsed;
+        y = motion.y + motion.vy * elapsed;
+    }
+
+    inline Vertex KineticVoronoi::sitePosition(int site) const
+    {
+        double x, y;
+        position(site, x, y);
+        return Vertex((float)x, (float)y);
+    }
+
+    inline bool KineticVoronoi::isGhost(int triangle) const
+    {
+        const int* sites = _triangles[triangle].sites;
+        return sites[0] < 0 || sites[1] < 0 || sites[2] < 0;
+    }
+
+    inline Vertex KineticVoronoi::voronoiVertex(int triangle) const
+    {
+        if (isGhost(triangle))
+            return Vertex::undefined;
+        const int* sites = _triangles[triangle].sites;
+        double ax, ay, bx, by, cx, cy;
+        position(sites[0], ax, ay);
+        position(sites[1], bx, by);
+        position(sites[2], cx, cy);
+        bx -= ax;
+        by -= ay;
+        cx -= ax;
+        cy -= ay;
+        const double d = 2.0 * (bx * cy - by * cx);
+        if (d == 0.0)
+            return Vertex::undefined;
+        const double b2 = bx * bx + by * by;
+        const double c2 = cx * cx + cy * cy;
+        return Vertex((float)(ax + (cy * b2 - by * c2) / d),
+                      (float)(ay + (bx * c2 - cx * b2) / d));
+    }
+
+    inline void KineticVoronoi::neighbors(int site,
+                                          std::vector<int>& found) const
+    {
+        found.clear();
+        const int first = _siteTriangles[site];
+        if (first < 0)
+            return;
+        int t = first;
+        do
+        {
+            const KineticTriangle& triangle = _triangles[t];
+            const int k = triangle.sites[0] == site ? 0 :
+                          triangle.sites[1] == site ? 1 : 2;
+            if (triangle.sites[(k + 1) % 3] >= 0)
+                found.push_back(triangle.sites[(k + 1) % 3]);
+            t = triangle.adjacent[(k + 1) % 3];
+        }
+        while (t != first && t >= 0);
+    }
+
+    inline int KineticVoronoi::certificate(int triangle, int slot,
+                                           double* polynomial,
+                                           double* exact) const
+    {
+        const KineticTriangle& t = _triangles[triangle];
+        const KineticTriangle& u = _triangles[t.adjacent[slot]];
+        const int j = u.adjacent[0] == triangle ? 0 :
+                      u.adjacent[1] == triangle ? 1 : 2;
+        const int a = t.sites[slot],
+                  b = t.sites[(slot + 1) % 3],
+                  c = t.sites[(slot + 2) % 3],
+                  d = u.sites[j];
+
+        //  next to a ghost the edge fails when three sites turn
+        //  counterclockwise: the hull vertex on the edge sinking inside
+        //  (b or c at infinity), or the site across crossing the hull
+        //  edge (a or d at infinity)
+        int turn[3] = { -1, -1, -1 };
+        if (b < 0)
+            turn[0] = d, turn[1] = c, turn[2] = a;
+        else if (c < 0)
+            turn[0] = a, turn[1] = b, turn[2] = d;
+        else if (a < 0)
+            turn[0] = b, turn[1] = c, turn[2] = d;
+        else if (d < 0)
+            turn[0] = a, turn[1] = c, turn[2] = b;
+
+        //  positions relative to the last site, linear in time
+        const int count = turn[0] >= 0 ? 3 : 4;
+        int quad[4] = { a, b, c, d };
+        const int* sites = turn[0] >= 0 ? turn : quad;
+        double px[4], py[4];
+        for (int i = 0; i < count; ++i)
+            position(sites[i], px[i], py[i]);
+        const Motion& pivot = _motions[sites[count - 1]];
+        double x[3][2], y[3][2];
+        for (int i = 0; i + 1 < count; ++i)
+        {
+            const Motion& motion = _motions[sites[i]];
+            x[i][0] = px[i] - px[count - 1];
+            x[i][1] = motion.vx - pivot.vx;
+            y[i][0] = py[i] - py[count - 1];
+            y[i][1] = motion.vy - pivot.vy;
+        }
+
+        double first[3], second[3];
+        if (count == 3)
+        {
+            if (exact)
+            {
+                *exact = predicates::orient2d(px[0], py[0], px[1], py[1],
+                                              px[2], py[2]);
+            }
+            detail::multiplyPolynomials(x[0], 1, y[1], 1, first);
+            detail::multiplyPolynomials(y[0], 1, x[1], 1, second);
+            for (int i = 0; i <= 2; ++i)
+                polynomial[i] = first[i] - second[i];
+            return 2;
+        }
+
+        if (exact)
+        {
+            *exact = predicates::incircle(px[0], py[0], px[1], py[1],
+                                          px[2], py[2], px[3], py[3]);
+        }
+        std::fill(polynomial, polynomial + 5, 0.0);
+        for (int i = 0; i < 3; ++i)
+        {
+            //  lift(i) * cross(i+1, i+2)
+            const int m = (i + 1) % 3, n = (i + 2) % 3;
+            double lift[3], cross[3], term[5];
+            detail::multiplyPolynomials(x[i], 1, x[i], 1, first);
+            detail::multiplyPolynomials(y[i], 1, y[i], 1, second);
+            for (int k = 0; k <= 2; ++k)
+                lift[k] = first[k] + second[k];
+            detail::multiplyPolynomials(x[m], 1, y[n], 1, first);
+            detail::multiplyPolynomials(y[m], 1, x[n], 1, second);
+            for (int k = 0; k <= 2; ++k)
+                cross[k] = first[k] - second[k];
+            detail::multiplyPolynomials(lift, 2, cross, 2, term);
+            for (int k = 0; k <= 4; ++k)
+                polynomial[k] += term[k];
+        }
+        return 4;
+    }
+
+    //  Queues when the edge opposite slot fails, from its lower numbered
+    //  triangle.
+    inline void KineticVoronoi::certify(int triangle, int slot)
+    {
+        int neighbor = _triangles[triangle].adjacent[slot];
+        if (neighbor < 0)
+            return;
+        if (neighbor < triangle)
+        {
+            const KineticTriangle& u = _triangles[neighbor];
+            slot = u.adjacent[0] == triangle ? 0 :
+                   u.adjacent[1] == triangle ? 1 : 2;
+            std::swap(triangle, neighbor);
+        }
+
+        //  a constant certificate (the sites moving together) fails now
+        //  or never, by its exact sign
+        const double never = std::numeric_limits<double>::infinity();
+        double polynomial[5];
+        int degree = certificate(triangle, slot, polynomial);
+        while (degree > 0 && polynomial[degree] == 0.0)
+            --degree;
+        double delay;
+        if (degree > 0)
+        {
+            delay = detail::firstRise(polynomial, degree);
+        }
+        else
+        {
+            double exact;
+            certificate(triangle, slot, polynomial, &exact);
+            delay = exact > 0.0 ? 0.0 : never;
+        }
+        if (delay == never)
+            return;
+
+        Event event;
+        event.time = _time + delay;
+        event.triangle = triangle;
+        event.slot = slot;
+        event.neighbor = neighbor;
+        event.stamp = _stamps[triangle];
+        event.neighborStamp = _stamps[neighbor];
+        _events.push(event);
+    }
+
+    //  Triangles t = (a, b, c) and u = (d, c, b) across bc become
+    //  t = (a, b, d) and u = (d, c, a) across ad.
+    inline void KineticVoronoi::flip(int triangle, int slot)
+    {
+        const int neighbor = _triangles[triangle].adjacent[slot];
+        KineticTriangle& t = _triangles[triangle];
+        KineticTriangle& u = _triangles[neighbor];
+        const int i = slot;
+        const int j = u.adjacent[0] == triangle ? 0 :
+                      u.adjacent[1] == triangle ? 1 : 2;
+        const int a = t.sites[i],
+                  b = t.sites[(i + 1) % 3],
+                  c = t.sites[(i + 2) % 3],
+                  d = u.sites[j];
+        const int acrossCA = t.adjacent[(i + 1) % 3],
+                  acrossAB = t.adjacent[(i + 2) % 3],
+                  acrossBD = u.adjacent[(j + 1) % 3],
+                  acrossDC = u.adjacent[(j + 2) % 3];
+
+        const KineticTriangle newT = { { a, b, d },
+                                       { acrossBD, neighbor, acrossAB } };
+        const KineticTriangle newU = { { d, c, a },
+                                       { acrossCA, triangle, acrossDC } };
+        t = newT;
+        u = newU;
+
+        //  the outer triangles that changed sides
+        auto relink = [this](int outer, int from, int to)
+        {
+            if (outer < 0)
+                return;
+            int* adjacent = _triangles[outer].adjacent;
+            for (int k = 0; k < 3; ++k)
+            {
+                if (adjacent[k] == from)
+                    adjacent[k] = to;
+            }
+        };
+        relink(acrossBD, neighbor, triangle);
+        relink(acrossCA, triangle, neighbor);
+
+        for (int site : { a, b, d })
+        {
+            if (site >= 0)
+                _siteTriangles[site] = triangle;
+        }
+        if (c >= 0)
+            _siteTriangles[c] = neighbor;
+
+        ++_stamps[triangle];
+        ++_stamps[neighbor];
+        ++_flipCount;
+
+        certify(triangle, 0);
+        certify(triangle, 1);
+        certify(triangle, 2);
+        certify(neighbor, 0);
+        certify(neighbor, 2);
+    }
+
+    inline void KineticVoronoi::advance(double time)
+    {
+        while (!_events.empty() && _events.top().time <= time)
+        {
+            const Event event = _events.top();
+            _events.pop();
+            const KineticTriangle& triangle = _triangles[event.triangle];
+            if (_stamps[event.triangle] != event.stamp ||
+                triangle.adjacent[event.slot] != event.neighbor ||
+                _stamps[event.neighbor] != event.neighborStamp)
+                continue;
+            _time = std::max(_time, event.time);
+            flip(event.triangle, event.slot);
+        }
+        _time = std::max(_time, time);
+    }
+
+    inline void KineticVoronoi::setVelocity(int site,
+                                            const Vertex& velocity)
+    {
+        Motion& motion = _motions[site];
+        position(site, motion.x, motion.y);
+        motion.vx = velocity.x;
+        motion.vy = velocity.y;
+        motion.since = _time;
+
+        //  every certificate involving the site belongs to an edge of a
+        //  triangle around it
+        const int first = _siteTriangles[site];
+        if (first < 0)
+            return;
+        _ring.clear();
+        int t = first;
+        do
+        {
+            _ring.push_back(t);
+            const KineticTriangle& triangle = _triangles[t];
+            const int k = triangle.sites[0] == site ? 0 :
+                          triangle.sites[1] == site ? 1 : 2;
+            t = triangle.adjacent[(k + 1) % 3];
+        }
+        while (t != first && t >= 0);
+
+        for (int triangle : _ring)
+            ++_stamps[triangle];
+        for (int triangle : _ring)
+        {
+            for (int i = 0; i < 3; ++i)
+                certify(triangle, i);
+        }
+    }
+
+    }   // namespace voronoi
+}   // namespace cinekine
+
+#endif
@@ -8,6 +8,9 @@
 #include <algorithm>
 #include <limits>
 #include <iostream>
+#include <cmath>
+#include <string>
+#include <random>
 
 using namespace std;
 
@@ -27,8 +30,293 @@ cinekine::voronoi::Sites createSites(size_t count, float xBound, float yBound)
     return sites;
 }
 
+//  Sites within half a unit of the box's border, plus a fan of fanCount
+//  sites on a line just outside the top border, under one border site.
+//  Every fan site neighbours the border site, whose cell gets a half
+//  edge for each, many of them clipped away or too short to keep.
+cinekine::voronoi::Sites createBorderSites(size_t count, size_t fanCount,
+                                           float xBound, float yBound)
+{
+    cinekine::voronoi::Sites sites;
+    sites.reserve(count + fanCount + 1);
+
+    //  the fan, kept clear of the other border sites
+    const float cx = 0.5f * xBound, radius = 0.25f * xBound;
+
+    const float perimeter = 2.0f * (xBound + yBound);
+    while (sites.size() < count)
+    {
+        float along = perimeter * (rand() / (RAND_MAX + 1.0f));
+        float inset = 0.5f * (rand() / (RAND_MAX + 1.0f));
+        float x, y;
+        if (along < xBound)
+            x = along, y = inset;
+        else if ((along -= xBound) < yBound)
+            x = xBound - inset, y = along;
+        else if ((along -= yBound) < xBound)
+            x = xBound - along, y = yBound - inset;
+        else
+            x = inset, y = yBound - (along - xBound);
+        if (fanCount && y < 1.0f && fabs(x - cx) < 1.5f * radius)
+            continue;
+        sites.emplace_back(cinekine::voronoi::Vertex(x, y));
+    }
+
+    sites.emplace_back(cinekine::voronoi::Vertex(cx, 0.0f));
+    for (size_t i = 0; i < fanCount; i++)
+    {
+        float x = cx - radius + 2.0f * radius * (i + 0.5f) / fanCount;
+        sites.emplace_back(cinekine::voronoi::Vertex(x, -10.0f));
+    }
+
+    return sites;
+}
+
+//  Stress benchmark for cell finalization: every site near the border, and
+//  one cell with a fan's worth of half edges to prune.  Doubling the fan
+//  should at most double the time spent on it; pruning by erasing one
+//  half edge at a time quadruples it.
+int boundaryBenchmark()
+{
+    const float xBound = 1000.0f, yBound = 1000.0f;
+    const size_t counts[] = { 100000, 1000000 };
+    const size_t fans[] = { 0, 100000, 200000, 400000, 800000 };
+
+    for (size_t count : counts)
+    {
+        for (size_t fan : fans)
+        {
+            srand(1);
+            cinekine::voronoi::Sites sites =
+                createBorderSites(count, fan, xBound, yBound);
+
+            auto start = chrono::steady_clock::now();
+            cinekine::voronoi::Graph graph =
+                cinekine::voronoi::build(std::move(sites), xBound, yBound);
+            double seconds = chrono::duration<double>(
+                chrono::steady_clock::now() - start).count();
+
+            size_t largest = 0;
+            for (auto& cell : graph.cells())
+                largest = max(largest, cell.halfEdges.size());
+            printf("%7lu border sites, fan %5lu: %.3fs, largest cell %lu "
+                   "edges\n", (unsigned long)count, (unsigned long)fan,
+                   seconds, (unsigned long)largest);
+        }
+    }
+    return 0;
+}
+
+//  count sites on a circle of radius 33.3 about the centre of a 100x100
+//  box, rounded to float, so every circle event is nearly cocircular
+//  with its neighbours'.
+cinekine::voronoi::Sites createRingSites(size_t count)
+{
+    cinekine::voronoi::Sites sites;
+    sites.reserve(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        double angle = 2.0 * M_PI * i / count;
+        sites.emplace_back(
+            cinekine::voronoi::Vertex(float(50.0 + 33.3 * cos(angle)),
+                                      float(50.0 + 33.3 * sin(angle))));
+    }
+    return sites;
+}
+
+//  Regression check for Robustness::Adaptive on near-cocircular rings: the
+//  cells must be closed and their areas must add up to the box's.
+int ringCheck()
+{
+    const size_t counts[] = { 30, 40, 50, 64, 100, 2000, 20000 };
+    int failed = 0;
+
+    for (size_t count : counts)
+    {
+        cinekine::voronoi::BuildOptions options;
+        options.robustness = cinekine::voronoi::Robustness::Adaptive;
+        options.cellMetrics = true;
+        cinekine::voronoi::Graph graph =
+            cinekine::voronoi::build(createRingSites(count), 100.0f, 100.0f,
+                                     options);
+
+        double area = 0.0;
+        size_t open = 0;
+        for (size_t c = 0; c < graph.cells().size(); c++)
+        {
+            area += graph.cellMetrics().area[c];
+            auto& halfEdges = graph.cells()[c].halfEdges;
+            for (size_t i = 0; i < halfEdges.size(); i++)
+            {
+                cinekine::voronoi::Vertex end =
+                    graph.getHalfEdgeEndpoint(halfEdges[i]);
+                cinekine::voronoi::Vertex start = graph.getHalfEdgeStartpoint(
+                    halfEdges[(i + 1) % halfEdges.size()]);
+                if (fabs(end.x - start.x) + fabs(end.y - start.y) > 1e-3f)
+                {
+                    ++open;
+                    break;
+                }
+            }
+        }
+
+        bool ok = open == 0 && fabs(area - 10000.0) < 0.05;
+        printf("%5lu ring sites: area %.2f, %lu open cells%s\n",
+               (unsigned long)count, area, (unsigned long)open,
+               ok ? "" : "  FAILED");
+        failed += !ok;
+    }
+    return failed ? 1 : 0;
+}
+
+//  Overhead of Robustness::Adaptive over Epsilon on uniform random sites,
+//  where the floating-point filter settles almost every test.  Best of
+//  three runs per mode.
+int robustnessBenchmark()
+{
+    const float xBound = 1000.0f, yBound = 1000.0f;
+    const size_t counts[] = { 10000, 200000, 1000000 };
+    const cinekine::voronoi::Robustness modes[] = {
+        cinekine::voronoi::Robustness::Epsilon,
+        cinekine::voronoi::Robustness::Adaptive
+    };
+
+    for (size_t count : counts)
+    {
+        double best[2] = { numeric_limits<double>::max(),
+                           numeric_limits<double>::max() };
+        for (int run = 0; run < 3; run++)
+        {
+            for (int m = 0; m < 2; m++)
+            {
+                srand(1);
+                cinekine::voronoi::Sites sites;
+                sites.reserve(count);
+                while (sites.size() < count)
+                {
+                    float x = xBound * (rand() / (RAND_MAX + 1.0f));
+                    float y = yBound * (rand() / (RAND_MAX + 1.0f));
+                    sites.emplace_back(cinekine::voronoi::Vertex(x, y));
+                }
+                cinekine::voronoi::BuildOptions options;
+                options.robustness = modes[m];
+
+                auto start = chrono::steady_clock::now();
+                cinekine::voronoi::Graph graph = cinekine::voronoi::build(
+                    std::move(sites), xBound, yBound, options);
+                best[m] = min(best[m], chrono::duration<double>(
+                    chrono::steady_clock::now() - start).count());
+            }
+        }
+        printf("%7lu uniform sites: epsilon %.3fs, adaptive %.3fs "
+               "(%+.0f%%)\n", (unsigned long)count, best[0], best[1],
+               100.0 * (best[1] / best[0] - 1.0));
+    }
+    return 0;
+}
+
+//  Regression check for buildWindow on a window overhanging the sites'
+//  extent: 50000 uniform sites in [0,1000]^2, the window reaching 746
+//  units past them.  Each of 1000 random points of the window must lie
+//  in the cell of its nearest site, found by brute force, and in no
+//  other, and the cells' areas must add up to the window's.
+int windowCheck()
+{
+    const size_t count = 50000;
+    const float minX = 727.36f, minY = 66.50f;
+    const float maxX = 1746.74f, maxY = 263.84f;
+
+    mt19937 random(3);
+    uniform_real_distribution<float> uniform(0.0f, 1000.0f);
+    cinekine::voronoi::Sites sites;
+    sites.reserve(count);
+    while (sites.size() < count)
+    {
+        float y = uniform(random);
+        float x = uniform(random);
+        sites.emplace_back(cinekine::voronoi::Vertex(x, y));
+    }
+    cinekine::voronoi::SiteBuckets buckets(sites);
+    cinekine::voronoi::BuildOptions options;
+    options.cellMetrics = true;
+    cinekine::voronoi::Graph graph =
+        cinekine::voronoi::buildWindow(buckets, minX, minY, maxX, maxY,
+                                       options);
+
+    double area = 0.0;
+    for (size_t c = 0; c < graph.cells().size(); c++)
+        area += graph.cellMetrics().area[c];
+    const double windowArea = (double)(maxX - minX) * (maxY - minY);
+
+    //  half edges run clockwise, the cell to their right; slack > 0 lets
+    //  the point stray that far outside
+    auto inside = [&graph](const cinekine::voronoi::Cell& cell,
+                           float x, float y, float slack)
+    {
+        if (cell.halfEdges.empty())
+            return false;
+        for (auto& halfEdge : cell.halfEdges)
+        {
+            cinekine::voronoi::Vertex a =
+                graph.getHalfEdgeStartpoint(halfEdge);
+            cinekine::voronoi::Vertex b = graph.getHalfEdgeEndpoint(halfEdge);
+            float side = (b.x - a.x) * (y - a.y) - (b.y - a.y) * (x - a.x);
+            if (side > slack * (fabs(b.x - a.x) + fabs(b.y - a.y)))
+                return false;
+        }
+        return true;
+    };
+
+    const vector<int>& sources = graph.siteSources();
+    size_t wrong = 0;
+    const size_t samples = 1000;
+    uniform_real_distribution<float> alongX(minX, maxX), alongY(minY, maxY);
+    for (size_t i = 0; i < samples; i++)
+    {
+        float px = alongX(random), py = alongY(random);
+        size_t nearest = 0;
+        double nearestDistance = numeric_limits<double>::max();
+        for (size_t s = 0; s < count; s++)
+        {
+            double dx = sites[s].x - px, dy = sites[s].y - py;
+            if (dx*dx + dy*dy < nearestDistance)
+            {
+                nearestDistance = dx*dx + dy*dy;
+                nearest = s;
+            }
+        }
+        size_t site = find(sources.begin(), sources.end(), (int)nearest) -
+                      sources.begin();
+        int cell = site < sources.size() ? graph.siteCell((int)site) : -1;
+        bool ok = cell >= 0 &&
+                  inside(graph.cells()[cell], px - minX, py - minY, 1e-3f);
+        for (int c = 0; ok && c < (int)graph.cells().size(); c++)
+        {
+            if (c != cell &&
+                inside(graph.cells()[c], px - minX, py - minY, -1e-3f))
+                ok = false;
+        }
+        wrong += !ok;
+    }
+
+    bool ok = wrong == 0 && fabs(area - windowArea) < 1e-6 * windowArea;
+    printf("window cells: area %.3f of %.3f, %lu of %lu points in the "
+           "wrong cell%s\n", area, windowArea, (unsigned long)wrong,
+           (unsigned long)samples, ok ? "" : "  FAILED");
+    return ok ? 0 : 1;
+}
+
 int main(int argc, const char* argv[])
 {
+	if (argc > 1 && string(argv[1]) == "--boundary-bench")
+	    return boundaryBenchmark();
+	if (argc > 1 && string(argv[1]) == "--ring-check")
+	    return ringCheck();
+	if (argc > 1 && string(argv[1]) == "--robustness-bench")
+	    return robustnessBenchmark();
+	if (argc > 1 && string(argv[1]) == "--window-check")
+	    return windowCheck();
+
 	
 	int seed;
 	cout<<"Please enter the seed"<<endl;
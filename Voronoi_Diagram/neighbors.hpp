@@ -0,0 +1,456 @@
+#ifndef CK_VORONOI_NEIGHBORS_HPP
+#define CK_VORONOI_NEIGHBORS_HPP
+
+#include <vector>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include "voronoi.hpp"
+
+//  Nearest-site queries over the Delaunay graph of a built Graph.
+//
+//  Every Edge with two sites joins Delaunay neighbours, including edges
+//  the bounding box clipped away, so Graph::edges() carries the complete
+//  Delaunay graph.  Its properties make a separate spatial index
+//  unnecessary:
+//
+//  - a greedy walk towards a point, always stepping to a closer neighbour,
+//    stops at the site nearest the point
+//  - the k nearest sites form a connected subgraph holding the nearest
+//    site, so a best-first expansion from it pops them in order
+//  - the sites inside a disk form a connected subgraph, so the same
+//    expansion restricted to the disk finds all of them
+//
+//  A compacted graph (BuildOptions::compact) only keeps the edges within
+//  the bounds.  That is still enough for sites and query points within
+//  the bounds: each property rests on the edge where the segment from a
+//  site towards the query point leaves the site's cell, and that edge
+//  lies on the segment.
+//
+//  SiteIndex stores the adjacency in compressed rows plus a coarse grid
+//  of walk starting points (about one per four sites.)  Queries need
+//  per-thread scratch space, held by a SiteQuery; the batch calls make
+//  one per thread.
+//
+//  Distances are planar, so periodic graphs are not supported, nor are
+//  graphs built by buildSampledSegments, whose edges are not Delaunay.
+
+namespace cinekine
+{
+    namespace voronoi
+    {
+
+    /**
+     * @struct SiteDistance
+     * @brief  A site and its squared distance from a query point
+     */
+    struct SiteDistance
+    {
+        int site;
+        float distanceSq;
+    };
+
+    /** A site distances container */
+    typedef std::vector<SiteDistance> SiteDistances;
+
+    class SiteQuery;
+
+    /**
+     * @class SiteIndex
+     * @brief Delaunay adjacency of a Graph's sites, for nearest-site and
+     *        radius queries
+     *
+     * The index keeps a reference to the graph, which must outlive it.
+     */
+    class SiteIndex
+    {
+    public:
+        explicit SiteIndex(const Graph& graph);
+
+        const Graph& graph() const { return _graph; }
+
+        //  Delaunay neighbours of a site
+        const int* neighborsBegin(int site) const {
+            return _neighbors.data() + _offsets[site];
+        }
+        const int* neighborsEnd(int site) const {
+            return _neighbors.data() + _offsets[site + 1];
+        }
+
+        //  The site nearest (x, y), walking from the seed grid or from hint
+        //  (a valid site), whichever is closer.  -1 if there are no sites.
+        int nearestSite(float x, float y, int hint = -1) const;
+
+        //  For each of count points, its k nearest sites, nearest first,
+        //  written to results[i*k, i*k + k).  Points with fewer than k
+        //  reachable sites are padded with { -1, infinity }.
+        void nearestBatch(const Vertex* points, size_t count, unsigned k,
+                          SiteDistances& results,
+                          unsigned threadCount = 1) const;
+
+        //  For each of count points, the sites within radius, nearest
+        //  first, written to results[offsets[i], offsets[i+1]).
+        void withinBatch(const Vertex* points, size_t count, float radius,
+                         std::vector<size_t>& offsets,
+                         SiteDistances& results,
+                         unsigned threadCount = 1) const;
+
+    private:
+        friend class SiteQuery;
+
+        int seedSite(float x, float y) const;
+
+        const Graph& _graph;
+        std::vector<int> _offsets;
+        std::vector<int> _neighbors;
+
+        std::vector<int> _seeds;
+        int _gridSize;
+        float _minX, _minY;
+        float _cellWidth, _cellHeight;
+    };
+
+    /**
+     * @class SiteQuery
+     * @brief Runs queries against a SiteIndex, holding the scratch space
+     *        they need.  One per thread.
+     */
+    class SiteQuery
+    {
+    public:
+        explicit SiteQuery(const SiteIndex& index);
+
+        //  The k nearest sites to (x, y), nearest first (fewer if the
+        //  graph has fewer sites.)  Returns the nearest site or -1.
+        int nearest(float x, float y, unsigned k, SiteDistances& results,
+                    int hint = -1);
+
+        //  The sites within radius of (x, y), nearest first.  Returns the
+        //  nearest site overall (which may lie outside radius) or -1.
+        int within(float x, float y, float radius, SiteDistances& results,
+                   int hint = -1);
+
+    private:
+        struct Farther
+        {
+            bool operator()(const SiteDistance& a,
+                            const SiteDistance& b) const {
+                return a.distanceSq > b.distanceSq;
+            }
+        };
+
+        //  pops sites in order of distance, while they're within
+        //  maxDistanceSq and fewer than limit have been popped
+        void expand(float x, float y, int start, float maxDistanceSq,
+                    size_t limit, SiteDistances& results);
+        bool visit(int site);
+
+        const SiteIndex& _index;
+        std::vector<unsigned> _visited;
+        unsigned _stamp;
+        std::vector<SiteDistance> _frontier;
+    };
+
+    inline float siteDistanceSq(const Vertex& site, float x, float y)
+    {
+        const float dx = site.x - x;
+        const float dy = site.y - y;
+        return dx*dx + dy*dy;
+    }
+
+    inline SiteIndex::SiteIndex(const Graph& graph) :
+        _graph(graph),
+        _gridSize(0),
+        _minX(0.0f), _minY(0.0f),
+        _cellWidth(1.0f), _cellHeight(1.0f)
+    {
+        const int siteCount = (int)graph.siteCount();
+
+        //  adjacency in compressed rows: count, prefix sum, fill
+        _offsets.assign(siteCount + 1, 0);
+        for (auto& edge : graph.edges())
+        {
+            if (edge.leftSite < 0 || edge.rightSite < 0 ||
+                edge.leftSite == edge.rightSite)
+                continue;
+            ++_offsets[edge.leftSite + 1];
+            ++_offsets[edge.rightSite + 1];
+        }
+        for (int site = 0; site < siteCount; ++site)
+            _offsets[site + 1] += _offsets[site];
+
+        _neighbors.resize(_offsets[siteCount]);
+        std::vector<int> fill(_offsets.begin(), _offsets.end() - 1);
+        for (auto& edge : graph.edges())
+        {
+            if (edge.leftSite < 0 || edge.rightSite < 0 ||
+                edge.leftSite == edge.rightSite)
+                continue;
+            _neighbors[fill[edge.leftSite]++] = edge.rightSite;
+            _neighbors[fill[edge.rightSite]++] = edge.leftSite;
+        }
+
+        if (!siteCount)
+            return;
+
+        //  seed grid over the sites' bounds.  Sites without neighbours
+        //  (duplicates dropped by the sweep) are dead ends for a walk, so
+        //  they only seed a graph of one site.
+        const Vertex first = graph.sitePosition(0);
+        float maxX = first.x, maxY = first.y;
+        _minX = maxX;
+        _minY = maxY;
+        for (int i = 0; i < siteCount; ++i)
+        {
+            const Vertex site = graph.sitePosition(i);
+            _minX = std::min(_minX, site.x);
+            _minY = std::min(_minY, site.y);
+            maxX = std::max(maxX, site.x);
+            maxY = std::max(maxY, site.y);
+        }
+        _gridSize = std::max(1, (int)std::sqrt(siteCount / 4.0f));
+        _cellWidth = std::max((maxX - _minX) / _gridSize,
+                              std::numeric_limits<float>::min());
+        _cellHeight = std::max((maxY - _minY) / _gridSize,
+                               std::numeric_limits<float>::min());
+
+        _seeds.assign(_gridSize * _gridSize, -1);
+        for (int site = 0; site < siteCount; ++site)
+        {
+            if (siteCount > 1 && _offsets[site] == _offsets[site + 1])
+                continue;
+            const Vertex position = graph.sitePosition(site);
+            int gx = std::min(_gridSize - 1,
+                        (int)((position.x - _minX) / _cellWidth));
+            int gy = std::min(_gridSize - 1,
+                        (int)((position.y - _minY) / _cellHeight));
+            _seeds[gy * _gridSize + gx] = site;
+        }
+
+        //  give empty grid cells a nearby seed: sweep forwards then back
+        //  along the row-major order, each taking its predecessor's
+        int last = -1;
+        for (auto& seed : _seeds)
+        {
+            if (seed < 0) seed = last;
+            else last = seed;
+        }
+        last = -1;
+        for (auto seed = _seeds.rbegin(); seed != _seeds.rend(); ++seed)
+        {
+            if (*seed < 0) *seed = last;
+            else last = *seed;
+        }
+    }
+
+    inline int SiteIndex::seedSite(float x, float y) const
+    {
+        if (_seeds.empty())
+            return -1;
+        float fx = (x - _minX) / _cellWidth;
+        float fy = (y - _minY) / _cellHeight;
+        int gx = fx > 0.0f ? std::min(_gridSize - 1, (int)fx) : 0;
+        int gy = fy > 0.0f ? std::min(_gridSize - 1, (int)fy) : 0;
+        return _seeds[gy * _gridSize + gx];
+    }
+
+    inline int SiteIndex::nearestSite(float x, float y, int hint) const
+    {
+        int site = seedSite(x, y);
+        if (site < 0)
+            return -1;
+
+        float distanceSq = siteDistanceSq(_graph.sitePosition(site), x, y);
+        if (hint >= 0 && hint < (int)_graph.siteCount() &&
+            _offsets[hint] != _offsets[hint + 1])
+        {
+            float hintDistanceSq =
+                siteDistanceSq(_graph.sitePosition(hint), x, y);
+            if (hintDistanceSq < distanceSq)
+            {
+                site = hint;
+                distanceSq = hintDistanceSq;
+            }
+        }
+        for (;;)
+        {
+            int closer = site;
+            for (auto neighbor = neighborsBegin(site);
+                 neighbor != neighborsEnd(site); ++neighbor)
+            {
+                float d =
+                    siteDistanceSq(_graph.sitePosition(*neighbor), x, y);
+                if (d < distanceSq)
+                {
+                    distanceSq = d;
+                    closer = *neighbor;
+                }
+            }
+            if (closer == site)
+                return site;
+            site = closer;
+        }
+    }
+
+    inline void SiteIndex::nearestBatch(const Vertex* points, size_t count,
+                                        unsigned k, SiteDistances& results,
+                                        unsigned threadCount) const
+    {
+        const SiteDistance none = {
+            -1, std::numeric_limits<float>::infinity()
+        };
+        results.assign(count * k, none);
+        if (!k || !count)
+            return;
+
+        threadCount = std::max(1u, std::min<unsigned>(threadCount,
+                                                      (unsigned)count));
+        parallelFor(threadCount, [&](unsigned thread)
+        {
+            SiteQuery query(*this);
+            SiteDistances found;
+            const size_t begin = count * thread / threadCount;
+            const size_t end = count * (thread + 1) / threadCount;
+            int hint = -1;
+            for (size_t i = begin; i < end; ++i)
+            {
+                //  consecutive points tend to be close; start each walk
+                //  from the previous answer
+                hint = query.nearest(points[i].x, points[i].y, k, found,
+                                     hint);
+                std::copy(found.begin(), found.end(),
+                          results.begin() + i * k);
+            }
+        });
+    }
+
+    inline void SiteIndex::withinBatch(const Vertex* points, size_t count,
+                                       float radius,
+                                       std::vector<size_t>& offsets,
+                                       SiteDistances& results,
+                                       unsigned threadCount) const
+    {
+        offsets.assign(count + 1, 0);
+        results.clear();
+        if (!count)
+            return;
+
+        threadCount = std::max(1u, std::min<unsigned>(threadCount,
+                                                      (unsigned)count));
+        std::vector<SiteDistances> threadResults(threadCount);
+        parallelFor(threadCount, [&](unsigned thread)
+        {
+            SiteQuery query(*this);
+            SiteDistances found;
+            SiteDistances& local = threadResults[thread];
+            const size_t begin = count * thread / threadCount;
+            const size_t end = count * (thread + 1) / threadCount;
+            int hint = -1;
+            for (size_t i = begin; i < end; ++i)
+            {
+                hint = query.within(points[i].x, points[i].y, radius, found,
+                                    hint);
+                local.insert(local.end(), found.begin(), found.end());
+                offsets[i + 1] = found.size();
+            }
+        });
+
+        for (size_t i = 0; i < count; ++i)
+            offsets[i + 1] += offsets[i];
+        results.reserve(offsets[count]);
+        for (auto& local : threadResults)
+            results.insert(results.end(), local.begin(), local.end());
+    }
+
+    inline SiteQuery::SiteQuery(const SiteIndex& index) :
+        _index(index),
+        _visited(index._graph.siteCount(), 0),
+        _stamp(0)
+    {
+    }
+
+    inline bool SiteQuery::visit(int site)
+    {
+        if (_visited[site] == _stamp)
+            return false;
+        _visited[site] = _stamp;
+        return true;
+    }
+
+    inline void SiteQuery::expand(float x, float y, int start,
+                                  float maxDistanceSq, size_t limit,
+                                  SiteDistances& results)
+    {
+        //  a stamp per query saves clearing the visited marks; clear them
+        //  only when the stamp wraps
+        if (++_stamp == 0)
+        {
+            std::fill(_visited.begin(), _visited.end(), 0);
+            _stamp = 1;
+        }
+
+        const Graph& graph = _index._graph;
+        _frontier.clear();
+        visit(start);
+        SiteDistance first = {
+            start, siteDistanceSq(graph.sitePosition(start), x, y)
+        };
+        _frontier.push_back(first);
+
+        while (!_frontier.empty() && results.size() < limit)
+        {
+            std::pop_heap(_frontier.begin(), _frontier.end(), Farther());
+            const SiteDistance nearest = _frontier.back();
+            _frontier.pop_back();
+            if (nearest.distanceSq > maxDistanceSq)
+                break;
+            results.push_back(nearest);
+
+            for (auto neighbor = _index.neighborsBegin(nearest.site);
+                 neighbor != _index.neighborsEnd(nearest.site); ++neighbor)
+            {
+                if (!visit(*neighbor))
+                    continue;
+                SiteDistance next = {
+                    *neighbor,
+                    siteDistanceSq(graph.sitePosition(*neighbor), x, y)
+                };
+                if (next.distanceSq > maxDistanceSq)
+                    continue;
+                _frontier.push_back(next);
+                std::push_heap(_frontier.begin(), _frontier.end(),
+                               Farther());
+            }
+        }
+    }
+
+    inline int SiteQuery::nearest(float x, float y, unsigned k,
+                                  SiteDistances& results, int hint)
+    {
+        results.clear();
+        int site = _index.nearestSite(x, y, hint);
+        if (site >= 0 && k > 0)
+        {
+            expand(x, y, site, std::numeric_limits<float>::infinity(), k,
+                   results);
+        }
+        return site;
+    }
+
+    inline int SiteQuery::within(float x, float y, float radius,
+                                 SiteDistances& results, int hint)
+    {
+        results.clear();
+        int site = _index.nearestSite(x, y, hint);
+        if (site >= 0)
+        {
+            expand(x, y, site, radius * radius,
+                   std::numeric_limits<size_t>::max(), results);
+        }
+        return site;
+    }
+
+    }   // namespace voronoi
+}   // namespace cinekine
+
+#endif
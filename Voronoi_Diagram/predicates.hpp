@@ -0,0 +1,510 @@
+#ifndef CK_VORONOI_PREDICATES_HPP
+#define CK_VORONOI_PREDICATES_HPP
+
+#include <vector>
+#include <cmath>
+#include <limits>
+
+//  Adaptive-precision geometric predicates after Jonathan Richard Shewchuk,
+//  "Adaptive Precision Floating-Point Arithmetic and Fast Robust Geometric
+//  Predicates" (1997).  http://www.cs.cmu.edu/~quake/robust.html
+//
+//  Each predicate first evaluates its determinant in plain double arithmetic
+//  and accepts the sign when it clears a forward error bound.  Only inputs
+//  that fail the filter fall through to exact expansion arithmetic, so the
+//  cost on well-conditioned input is a handful of extra flops.
+//
+//  NOTE: requires strict IEEE double arithmetic (no -ffast-math, no x87
+//  extended precision intermediates.)
+
+namespace cinekine
+{
+    namespace voronoi
+    {
+    namespace predicates
+    {
+
+    /** An expansion: nonoverlapping doubles, increasing magnitude */
+    typedef std::vector<double> Expansion;
+
+    namespace detail
+    {
+        const double epsilon = std::numeric_limits<double>::epsilon() * 0.5;
+        const double splitter = 134217729.0;    // 2^27 + 1
+
+        const double resultErrBound = (3.0 + 8.0*epsilon) * epsilon;
+        const double ccwErrBoundA = (3.0 + 16.0*epsilon) * epsilon;
+        const double ccwErrBoundB = (2.0 + 12.0*epsilon) * epsilon;
+        const double ccwErrBoundC = (9.0 + 64.0*epsilon) * epsilon * epsilon;
+        const double iccErrBoundA = (10.0 + 96.0*epsilon) * epsilon;
+        //  a*a*b - c*c*d + e*f*g with every factor a rounded difference
+        const double parabolaErrBoundA = (12.0 + 128.0*epsilon) * epsilon;
+
+        inline void fastTwoSum(double a, double b, double& x, double& y)
+        {
+            x = a + b;
+            double bvirt = x - a;
+            y = b - bvirt;
+        }
+
+        inline void twoSum(double a, double b, double& x, double& y)
+        {
+            x = a + b;
+            double bvirt = x - a;
+            double avirt = x - bvirt;
+            double bround = b - bvirt;
+            double around = a - avirt;
+            y = around + bround;
+        }
+
+        inline double twoDiffTail(double a, double b, double x)
+        {
+            double bvirt = a - x;
+            double avirt = x + bvirt;
+            double bround = bvirt - b;
+            double around = a - avirt;
+            return around + bround;
+        }
+
+        inline void twoDiff(double a, double b, double& x, double& y)
+        {
+            x = a - b;
+            y = twoDiffTail(a, b, x);
+        }
+
+        inline void split(double a, double& hi, double& lo)
+        {
+            double c = splitter * a;
+            double abig = c - a;
+            hi = c - abig;
+            lo = a - hi;
+        }
+
+        inline void twoProductPresplit(double a, double b,
+                                       double bhi, double blo,
+                                       double& x, double& y)
+        {
+            x = a * b;
+            double ahi, alo;
+            split(a, ahi, alo);
+            double err1 = x - (ahi * bhi);
+            double err2 = err1 - (alo * bhi);
+            double err3 = err2 - (ahi * blo);
+            y = (alo * blo) - err3;
+        }
+
+        inline void twoProduct(double a, double b, double& x, double& y)
+        {
+            double bhi, blo;
+            split(b, bhi, blo);
+            twoProductPresplit(a, b, bhi, blo, x, y);
+        }
+
+        //  h = e + f, zero components eliminated.  h must have room for
+        //  elen + flen components.  Returns the length of h.
+        inline int fastExpansionSumZeroElim(int elen, const double* e,
+                                            int flen, const double* f,
+                                            double* h)
+        {
+            double Q, Qnew, hh;
+            int eindex = 0, findex = 0, hindex = 0;
+            double enow = e[0];
+            double fnow = f[0];
+
+            if ((fnow > enow) == (fnow > -enow))
+            {
+                Q = enow;
+                enow = (++eindex < elen) ? e[eindex] : 0.0;
+            }
+            else
+            {
+                Q = fnow;
+                fnow = (++findex < flen) ? f[findex] : 0.0;
+            }
+            if (eindex < elen && findex < flen)
+            {
+                if ((fnow > enow) == (fnow > -enow))
+                {
+                    fastTwoSum(enow, Q, Qnew, hh);
+                    enow = (++eindex < elen) ? e[eindex] : 0.0;
+                }
+                else
+                {
+                    fastTwoSum(fnow, Q, Qnew, hh);
+                    fnow = (++findex < flen) ? f[findex] : 0.0;
+                }
+                Q = Qnew;
+                if (hh != 0.0)
+                    h[hindex++] = hh;
+                while (eindex < elen && findex < flen)
+                {
+                    if ((fnow > enow) == (fnow > -enow))
+                    {
+                        twoSum(Q, enow, Qnew, hh);
+                        enow = (++eindex < elen) ? e[eindex] : 0.0;
+                    }
+                    else
+                    {
+                        twoSum(Q, fnow, Qnew, hh);
+                        fnow = (++findex < flen) ? f[findex] : 0.0;
+                    }
+                    Q = Qnew;
+                    if (hh != 0.0)
+                        h[hindex++] = hh;
+                }
+            }
+            while (eindex < elen)
+            {
+                twoSum(Q, enow, Qnew, hh);
+                enow = (++eindex < elen) ? e[eindex] : 0.0;
+                Q = Qnew;
+                if (hh != 0.0)
+                    h[hindex++] = hh;
+            }
+            while (findex < flen)
+            {
+                twoSum(Q, fnow, Qnew, hh);
+                fnow = (++findex < flen) ? f[findex] : 0.0;
+                Q = Qnew;
+                if (hh != 0.0)
+                    h[hindex++] = hh;
+            }
+            if (Q != 0.0 || hindex == 0)
+                h[hindex++] = Q;
+
+            return hindex;
+        }
+
+        //  h = b * e, zero components eliminated.  h must have room for
+        //  2 * elen components.  Returns the length of h.
+        inline int scaleExpansionZeroElim(int elen, const double* e,
+                                          double b, double* h)
+        {
+            double Q, sum, hh, product1, product0;
+            double bhi, blo;
+            int hindex = 0;
+
+            split(b, bhi, blo);
+            twoProductPresplit(e[0], b, bhi, blo, Q, hh);
+            if (hh != 0.0)
+                h[hindex++] = hh;
+            for (int eindex = 1; eindex < elen; ++eindex)
+            {
+                twoProductPresplit(e[eindex], b, bhi, blo, product1, product0);
+                twoSum(Q, product0, sum, hh);
+                if (hh != 0.0)
+                    h[hindex++] = hh;
+                fastTwoSum(product1, sum, Q, hh);
+                if (hh != 0.0)
+                    h[hindex++] = hh;
+            }
+            if (Q != 0.0 || hindex == 0)
+                h[hindex++] = Q;
+
+            return hindex;
+        }
+
+        inline double estimate(int elen, const double* e)
+        {
+            double Q = e[0];
+            for (int i = 1; i < elen; ++i)
+                Q += e[i];
+            return Q;
+        }
+
+        //  exact a - b as a two component expansion
+        inline Expansion diff(double a, double b)
+        {
+            double x, y;
+            twoDiff(a, b, x, y);
+            if (y == 0.0)
+                return Expansion(1, x);
+            return Expansion{ y, x };
+        }
+
+        inline Expansion sum(const Expansion& e, const Expansion& f)
+        {
+            Expansion h(e.size() + f.size());
+            h.resize(fastExpansionSumZeroElim((int)e.size(), e.data(),
+                                              (int)f.size(), f.data(),
+                                              h.data()));
+            return h;
+        }
+
+        inline Expansion negate(Expansion e)
+        {
+            for (auto& c : e)
+                c = -c;
+            return e;
+        }
+
+        inline Expansion product(const Expansion& e, const Expansion& f)
+        {
+            Expansion h(1, 0.0);
+            Expansion term(2 * e.size());
+            for (double fc : f)
+            {
+                term.resize(2 * e.size());
+                term.resize(scaleExpansionZeroElim((int)e.size(), e.data(),
+                                                   fc, term.data()));
+                h = sum(h, term);
+            }
+            return h;
+        }
+
+        inline int sign(const Expansion& e)
+        {
+            //  the most significant component carries the sign
+            double top = e.back();
+            return top > 0.0 ? 1 : top < 0.0 ? -1 : 0;
+        }
+
+        inline double orient2dAdapt(double ax, double ay,
+                                    double bx, double by,
+                                    double cx, double cy,
+                                    double detsum)
+        {
+            double acx = ax - cx;
+            double bcx = bx - cx;
+            double acy = ay - cy;
+            double bcy = by - cy;
+
+            double detleft, detlefttail, detright, detrighttail;
+            twoProduct(acx, bcy, detleft, detlefttail);
+            twoProduct(acy, bcx, detright, detrighttail);
+
+            double l[2] = { detlefttail, detleft };
+            double r[2] = { -detrighttail, -detright };
+            double B[4];
+            int blen = fastExpansionSumZeroElim(2, l, 2, r, B);
+
+            double det = estimate(blen, B);
+            double errbound = ccwErrBoundB * detsum;
+            if (det >= errbound || -det >= errbound)
+                return det;
+
+            double acxtail = twoDiffTail(ax, cx, acx);
+            double bcxtail = twoDiffTail(bx, cx, bcx);
+            double acytail = twoDiffTail(ay, cy, acy);
+            double bcytail = twoDiffTail(by, cy, bcy);
+
+            if (acxtail == 0.0 && acytail == 0.0 &&
+                bcxtail == 0.0 && bcytail == 0.0)
+                return det;
+
+            errbound = ccwErrBoundC * detsum + resultErrBound * std::abs(det);
+            det += (acx * bcytail + bcy * acxtail)
+                 - (acy * bcxtail + bcx * acytail);
+            if (det >= errbound || -det >= errbound)
+                return det;
+
+            double s1, s0, t1, t0;
+            double u[4], v[4];
+            double C1[8], C2[12], D[16];
+
+            twoProduct(acxtail, bcy, s1, s0);
+            twoProduct(acytail, bcx, t1, t0);
+            double sl[2] = { s0, s1 };
+            double tl[2] = { -t0, -t1 };
+            int ulen = fastExpansionSumZeroElim(2, sl, 2, tl, u);
+            int c1len = fastExpansionSumZeroElim(blen, B, ulen, u, C1);
+
+            twoProduct(acx, bcytail, s1, s0);
+            twoProduct(acy, bcxtail, t1, t0);
+            sl[0] = s0; sl[1] = s1;
+            tl[0] = -t0; tl[1] = -t1;
+            ulen = fastExpansionSumZeroElim(2, sl, 2, tl, u);
+            int c2len = fastExpansionSumZeroElim(c1len, C1, ulen, u, C2);
+
+            twoProduct(acxtail, bcytail, s1, s0);
+            twoProduct(acytail, bcxtail, t1, t0);
+            sl[0] = s0; sl[1] = s1;
+            tl[0] = -t0; tl[1] = -t1;
+            int vlen = fastExpansionSumZeroElim(2, sl, 2, tl, v);
+            int dlen = fastExpansionSumZeroElim(c2len, C2, vlen, v, D);
+
+            return D[dlen-1];
+        }
+
+        inline double incircleExact(double ax, double ay,
+                                    double bx, double by,
+                                    double cx, double cy,
+                                    double dx, double dy)
+        {
+            Expansion adx = diff(ax, dx), ady = diff(ay, dy);
+            Expansion bdx = diff(bx, dx), bdy = diff(by, dy);
+            Expansion cdx = diff(cx, dx), cdy = diff(cy, dy);
+
+            Expansion alift = sum(product(adx, adx), product(ady, ady));
+            Expansion blift = sum(product(bdx, bdx), product(bdy, bdy));
+            Expansion clift = sum(product(cdx, cdx), product(cdy, cdy));
+
+            Expansion bc = sum(product(bdx, cdy), negate(product(cdx, bdy)));
+            Expansion ca = sum(product(cdx, ady), negate(product(adx, cdy)));
+            Expansion ab = sum(product(adx, bdy), negate(product(bdx, ady)));
+
+            Expansion det = sum(sum(product(alift, bc), product(blift, ca)),
+                                product(clift, ab));
+            return det.back();
+        }
+    }   // namespace detail
+
+    //  Returns a positive value if a, b, c occur in counterclockwise order
+    //  (y axis pointing up), negative if clockwise and zero if collinear.
+    //  The sign is exact, the magnitude is an approximation of twice the
+    //  signed area of the triangle.
+    inline double orient2d(double ax, double ay,
+                           double bx, double by,
+                           double cx, double cy)
+    {
+        double detleft = (ax - cx) * (by - cy);
+        double detright = (ay - cy) * (bx - cx);
+        double det = detleft - detright;
+        double detsum;
+
+        if (detleft > 0.0)
+        {
+            if (detright <= 0.0)
+                return det;
+            detsum = detleft + detright;
+        }
+        else if (detleft < 0.0)
+        {
+            if (detright >= 0.0)
+                return det;
+            detsum = -detleft - detright;
+        }
+        else
+        {
+            return det;
+        }
+
+        double errbound = detail::ccwErrBoundA * detsum;
+        if (det >= errbound || -det >= errbound)
+            return det;
+
+        return detail::orient2dAdapt(ax, ay, bx, by, cx, cy, detsum);
+    }
+
+    //  Returns a positive value if d lies inside the circle passing through
+    //  a, b, c (given in counterclockwise order), negative if outside and zero
+    //  if the four points are cocircular.  The sign is exact.
+    inline double incircle(double ax, double ay,
+                           double bx, double by,
+                           double cx, double cy,
+                           double dx, double dy)
+    {
+        double adx = ax - dx, bdx = bx - dx, cdx = cx - dx;
+        double ady = ay - dy, bdy = by - dy, cdy = cy - dy;
+
+        double bdxcdy = bdx * cdy;
+        double cdxbdy = cdx * bdy;
+        double alift = adx * adx + ady * ady;
+
+        double cdxady = cdx * ady;
+        double adxcdy = adx * cdy;
+        double blift = bdx * bdx + bdy * bdy;
+
+        double adxbdy = adx * bdy;
+        double bdxady = bdx * ady;
+        double clift = cdx * cdx + cdy * cdy;
+
+        double det = alift * (bdxcdy - cdxbdy)
+                   + blift * (cdxady - adxcdy)
+                   + clift * (adxbdy - bdxady);
+
+        double permanent = (std::abs(bdxcdy) + std::abs(cdxbdy)) * alift
+                         + (std::abs(cdxady) + std::abs(adxcdy)) * blift
+                         + (std::abs(adxbdy) + std::abs(bdxady)) * clift;
+        double errbound = detail::iccErrBoundA * permanent;
+        if (det > errbound || -det > errbound)
+            return det;
+
+        return detail::incircleExact(ax, ay, bx, by, cx, cy, dx, dy);
+    }
+
+    //  Compares the heights of two parabolic beach arcs at abscissa x.
+    //  The arcs have foci l and r and share the directrix y = directrix,
+    //  which must lie strictly beyond both foci.  Returns the sign of
+    //  (yl(x) - yr(x)): positive if arc l is closer to the directrix at x,
+    //  negative if arc r is, and zero if the arcs intersect at x.
+    inline int parabolaOrder(double lx, double ly,
+                             double rx, double ry,
+                             double x, double directrix)
+    {
+        //  sign of (x-lx)^2 * (ry-D) - (x-rx)^2 * (ly-D) + (ly-ry)(ly-D)(ry-D)
+        double a = x - lx, b = x - rx;
+        double dl = ly - directrix, dr = ry - directrix;
+        double e = ly - ry;
+
+        double t0 = a * a * dr;
+        double t1 = b * b * dl;
+        double t2 = e * dl * dr;
+        double det = t0 - t1 + t2;
+
+        double permanent = std::abs(t0) + std::abs(t1) + std::abs(t2);
+        double errbound = detail::parabolaErrBoundA * permanent;
+        if (det > errbound)
+            return 1;
+        if (-det > errbound)
+            return -1;
+
+        using namespace detail;
+        Expansion ae = diff(x, lx), be = diff(x, rx);
+        Expansion dle = diff(ly, directrix), dre = diff(ry, directrix);
+        Expansion ee = diff(ly, ry);
+
+        Expansion exact = sum(sum(product(product(ae, ae), dre),
+                                  negate(product(product(be, be), dle))),
+                              product(product(ee, dle), dre));
+        return sign(exact);
+    }
+
+    //  Locates x relative to the break point between beach arc l and its
+    //  right neighbour r for the given directrix (see parabolaOrder.)
+    //  Returns 1 if x is before (left of) the break point, 0 if exactly on
+    //  it and -1 if after it.
+    //
+    //  The two parabolas intersect twice; l|r is the intersection where l
+    //  stops being the arc closest to the directrix.  Which of the two roots
+    //  that is follows from which focus is closer to the directrix, and
+    //  which root x is nearest follows from the slope of the height
+    //  difference at x, itself an orientation test against (x, directrix).
+    inline int breakPointSide(double lx, double ly,
+                              double rx, double ry,
+                              double x, double directrix)
+    {
+        int order = parabolaOrder(lx, ly, rx, ry, x, directrix);
+
+        //  equal heights: a single break point midway between the foci
+        if (ly == ry)
+            return order;
+
+        //  the slope of the height difference (positive iff x is past its
+        //  apex when r is the narrower arc, before it when l is) tells the
+        //  two intersections apart
+
+        //  r is the narrower arc: l|r is the left intersection
+        if (ry > ly)
+        {
+            if (order < 0)
+                return -1;
+            double slope = -orient2d(lx, ly, rx, ry, x, directrix);
+            if (order > 0)
+                return slope < 0.0 ? 1 : -1;
+            return slope <= 0.0 ? 0 : -1;
+        }
+        //  l is the narrower arc: l|r is the right intersection
+        if (order > 0)
+            return 1;
+        double slope = -orient2d(lx, ly, rx, ry, x, directrix);
+        if (order == 0)
+            return slope > 0.0 ? 1 : 0;
+        return slope > 0.0 ? 1 : -1;
+    }
+
+    }   // namespace predicates
+    }   // namespace voronoi
+}   // namespace cinekine
+
+#endif
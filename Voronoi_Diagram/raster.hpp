@@ -0,0 +1,461 @@
+#ifndef CK_VORONOI_RASTER_HPP
+#define CK_VORONOI_RASTER_HPP
+
+#include <vector>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CK_VORONOI_RASTER_SSE2
+#endif
+#include "voronoi.hpp"
+
+//  Rasterizes a Graph into a label image: one uint32_t per pixel holding
+//  the index (into Graph::cells()) of the cell covering the pixel's
+//  centre.  The image spans the graph's bounds, row 0 at y = 0.
+//
+//  Two methods:
+//
+//  Scanline fills each cell row by row from its half edges.  Crossings
+//  are computed from edge end points in a canonical order, and pixel
+//  centres are taken half-open, so neighbouring cells tile the image
+//  with no gaps or overlaps.  Cells need not be convex (see
+//  buildSampledSegments.)
+//
+//  JumpFlood propagates the nearest site through the image in log2(size)
+//  passes plus one refining pass, never looking at the cells' edges.  The
+//  flood alone is approximate (a handful of pixels along edges take a
+//  neighbour's site), so a last pass walks each pixel's site over its
+//  Voronoi neighbours while one is nearer.  A pixel outside a site's cell
+//  lies beyond one of the cell's edges, whose other site is nearer, so
+//  the walk ends at the nearest site, and most pixels take no step.  Its
+//  cost doesn't depend on the number of sites, so it wins once cells are
+//  smaller than pixels and scanline fill spends its time on cells that
+//  cover no pixel centre.  It labels pixels by nearest site, so it only
+//  fits graphs whose cells are nearest site regions (see
+//  Graph::nearestSiteCells.)
+//
+//  distanceField() walks the same spans as Scanline and writes, per pixel,
+//  the distance to the site of the cell covering it: each pixel's nearest
+//  site is already known from its cell, so there is no search.  The span
+//  kernel runs four pixels at a time with SSE2 where available.
+//
+//  All of them split the image into bands of rows which threads take in
+//  turn.
+//  Periodic graphs are rasterized in the frame of each cell's site, so
+//  cells wrapping around the bounds are cut off there.
+
+namespace cinekine
+{
+    namespace voronoi
+    {
+
+    /**
+     * @enum  RasterMethod
+     * @brief How rasterizeCells() fills the label image
+     *
+     * Auto chooses JumpFlood when there are more sites than
+     * rasterAutoSitesPerPixel per pixel and the graph's cells are nearest
+     * site regions, and Scanline otherwise.  Both are exact.
+     */
+    enum class RasterMethod
+    {
+        Auto,
+        Scanline,
+        JumpFlood
+    };
+
+    //  label of pixels no cell covers
+    const uint32_t rasterNoCell = 0xffffffff;
+    const float rasterAutoSitesPerPixel = 2.0f;
+
+    namespace detail
+    {
+        const int rasterBandRows = 16;
+
+        //  runs band(first, last) over bands of rows, threads taking the
+        //  next unclaimed band as they finish one
+        template<typename Band>
+        void forEachRasterBand(int height, unsigned threadCount, Band band)
+        {
+            const int bandCount =
+                (height + rasterBandRows - 1) / rasterBandRows;
+            threadCount = std::max(1u, std::min<unsigned>(threadCount,
+                                                          bandCount));
+            std::atomic<int> nextBand(0);
+            parallelFor(threadCount, [&](unsigned)
+            {
+                for (;;)
+                {
+                    const int index = nextBand.fetch_add(1);
+                    if (index >= bandCount)
+                        break;
+                    const int first = index * rasterBandRows;
+                    band(first, std::min(height, first + rasterBandRows));
+                }
+            });
+        }
+
+        //  runs span(cell, row, x0, x1) for every run [x0, x1) of pixels
+        //  in row whose centres lie inside cell, threads taking bands of
+        //  rows.  Spans of one band are visited by one thread.
+        template<typename Span>
+        void forEachCellSpan(const Graph& graph, int width, int height,
+                             unsigned threadCount, Span span)
+        {
+            const Cells& cells = graph.cells();
+            const double scaleX = width / (double)graph.xBound();
+            const double scaleY = height / (double)graph.yBound();
+            const int bandCount =
+                (height + rasterBandRows - 1) / rasterBandRows;
+
+            //  cell outlines in pixel space, and the cells overlapping
+            //  each band
+            struct Point { double x, y; };
+            std::vector<Point> outlines;
+            std::vector<size_t> outlineStart(cells.size() + 1, 0);
+            std::vector<std::vector<int32_t>> bandCells(bandCount);
+            for (size_t cell = 0; cell < cells.size(); ++cell)
+            {
+                outlineStart[cell] = outlines.size();
+                const HalfEdges& halfEdges = cells[cell].halfEdges;
+                if (halfEdges.size() < 3)
+                    continue;
+                double minY = std::numeric_limits<double>::max();
+                double maxY = -minY;
+                for (auto& halfEdge : halfEdges)
+                {
+                    Vertex v = graph.getHalfEdgeStartpoint(halfEdge);
+                    Point p = { v.x * scaleX, v.y * scaleY };
+                    outlines.push_back(p);
+                    minY = std::min(minY, p.y);
+                    maxY = std::max(maxY, p.y);
+                }
+                //  rows whose centre (row + 0.5) lies in [minY, maxY)
+                int firstRow = std::max(0, (int)std::ceil(minY - 0.5));
+                int lastRow = std::min(height - 1,
+                                       (int)std::ceil(maxY - 0.5) - 1);
+                if (firstRow > lastRow)
+                    continue;
+                for (int b = firstRow / rasterBandRows;
+                     b <= lastRow / rasterBandRows; ++b)
+                {
+                    bandCells[b].push_back((int32_t)cell);
+                }
+            }
+            outlineStart[cells.size()] = outlines.size();
+
+            forEachRasterBand(height, threadCount,
+                [&](int firstRow, int endRow)
+                {
+                    std::vector<double> crossings;
+                    for (int32_t cell : bandCells[firstRow / rasterBandRows])
+                    {
+                        const Point* outline = &outlines[outlineStart[cell]];
+                        const size_t count =
+                            outlineStart[cell + 1] - outlineStart[cell];
+                        for (int row = firstRow; row < endRow; ++row)
+                        {
+                            const double y = row + 0.5;
+                            crossings.clear();
+                            for (size_t i = 0; i < count; ++i)
+                            {
+                                //  order the end points so both cells
+                                //  sharing an edge compute the same x
+                                Point a = outline[i];
+                                Point b = outline[(i + 1) % count];
+                                if (a.y > b.y || (a.y == b.y && a.x > b.x))
+                                    std::swap(a, b);
+                                if (a.y <= y && y < b.y)
+                                {
+                                    crossings.push_back(a.x +
+                                        (y - a.y) * (b.x - a.x) / (b.y - a.y));
+                                }
+                            }
+                            std::sort(crossings.begin(), crossings.end());
+                            for (size_t i = 0; i + 1 < crossings.size();
+                                 i += 2)
+                            {
+                                //  pixels whose centre lies in [x0, x1)
+                                int x0 = std::max(0,
+                                    (int)std::ceil(crossings[i] - 0.5));
+                                int x1 = std::min(width,
+                                    (int)std::ceil(crossings[i + 1] - 0.5));
+                                if (x0 < x1)
+                                    span(cell, row, x0, x1);
+                            }
+                        }
+                    }
+                });
+        }
+
+        //  out[i] = distance from (x + i*step, y) to the site, where dySq
+        //  is (y - siteY)^2 and dx0 is x - siteX
+        inline void distanceSpan(float* out, int count, float dx0,
+                                 float step, float dySq)
+        {
+            int i = 0;
+#ifdef CK_VORONOI_RASTER_SSE2
+            const __m128 lane = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+            const __m128 stepV = _mm_set1_ps(step);
+            const __m128 dySqV = _mm_set1_ps(dySq);
+            for (; i + 4 <= count; i += 4)
+            {
+                __m128 dx = _mm_add_ps(_mm_set1_ps(dx0 + i * step),
+                                       _mm_mul_ps(lane, stepV));
+                __m128 dSq = _mm_add_ps(_mm_mul_ps(dx, dx), dySqV);
+                _mm_storeu_ps(out + i, _mm_sqrt_ps(dSq));
+            }
+#endif
+            for (; i < count; ++i)
+            {
+                const float dx = dx0 + i * step;
+                out[i] = std::sqrt(dx*dx + dySq);
+            }
+        }
+
+        inline void rasterizeScanline(const Graph& graph,
+                                      std::vector<uint32_t>& labels,
+                                      int width, int height,
+                                      unsigned threadCount)
+        {
+            forEachCellSpan(graph, width, height, threadCount,
+                [&](int32_t cell, int row, int x0, int x1)
+                {
+                    uint32_t* line = &labels[(size_t)row * width];
+                    std::fill(line + x0, line + x1, (uint32_t)cell);
+                });
+        }
+
+        inline void rasterizeJumpFlood(const Graph& graph,
+                                       std::vector<uint32_t>& labels,
+                                       int width, int height,
+                                       unsigned threadCount)
+        {
+            const float pixelWidth = graph.xBound() / width;
+            const float pixelHeight = graph.yBound() / height;
+            auto distanceSq = [&](int site, int x, int y) -> float
+            {
+                const Vertex position = graph.sitePosition(site);
+                const float dx = position.x - (x + 0.5f) * pixelWidth;
+                const float dy = position.y - (y + 0.5f) * pixelHeight;
+                return dx*dx + dy*dy;
+            };
+
+            //  seed each site's pixel, the site nearest the centre winning
+            //  where several share one
+            std::vector<int32_t> nearest((size_t)width * height, -1);
+            for (int32_t site = 0; site < (int32_t)graph.siteCount(); ++site)
+            {
+                if (graph.siteCell(site) < 0)
+                    continue;
+                const Vertex position = graph.sitePosition(site);
+                int x = (int)(position.x / pixelWidth);
+                int y = (int)(position.y / pixelHeight);
+                if (x < 0 || x >= width || y < 0 || y >= height)
+                    continue;
+                int32_t& seed = nearest[(size_t)y * width + x];
+                if (seed < 0 ||
+                    distanceSq(site, x, y) < distanceSq(seed, x, y))
+                {
+                    seed = site;
+                }
+            }
+
+            //  Voronoi neighbours of each site, from the edges between two
+            //  sites
+            const Edges& edges = graph.edges();
+            std::vector<int32_t> neighborStart(graph.siteCount() + 1, 0);
+            for (auto& edge : edges)
+            {
+                if (edge.leftSite >= 0 && edge.rightSite >= 0)
+                {
+                    ++neighborStart[edge.leftSite + 1];
+                    ++neighborStart[edge.rightSite + 1];
+                }
+            }
+            for (size_t site = 0; site < graph.siteCount(); ++site)
+                neighborStart[site + 1] += neighborStart[site];
+            std::vector<int32_t> neighbors(neighborStart.back());
+            {
+                std::vector<int32_t> fill(neighborStart.begin(),
+                                          neighborStart.end() - 1);
+                for (auto& edge : edges)
+                {
+                    if (edge.leftSite >= 0 && edge.rightSite >= 0)
+                    {
+                        neighbors[fill[edge.leftSite]++] = edge.rightSite;
+                        neighbors[fill[edge.rightSite]++] = edge.leftSite;
+                    }
+                }
+            }
+
+            std::vector<int32_t> next(nearest.size());
+            std::vector<int> steps;
+            for (int step = std::max(width, height) / 2; step > 0;
+                 step /= 2)
+            {
+                steps.push_back(step);
+            }
+            steps.push_back(1);
+
+            for (int step : steps)
+            {
+                forEachRasterBand(height, threadCount,
+                    [&](int firstRow, int endRow)
+                    {
+                        for (int y = firstRow; y < endRow; ++y)
+                        {
+                            for (int x = 0; x < width; ++x)
+                            {
+                                int32_t best = nearest[(size_t)y * width + x];
+                                float bestDistanceSq = best < 0
+                                    ? std::numeric_limits<float>::max()
+                                    : distanceSq(best, x, y);
+                                for (int dy = -step; dy <= step; dy += step)
+                                {
+                                    const int sy = y + dy;
+                                    if (sy < 0 || sy >= height)
+                                        continue;
+                                    for (int dx = -step; dx <= step;
+                                         dx += step)
+                                    {
+                                        const int sx = x + dx;
+                                        if (sx < 0 || sx >= width ||
+                                            (!dx && !dy))
+                                            continue;
+                                        int32_t seed =
+                                            nearest[(size_t)sy * width + sx];
+                                        if (seed < 0 || seed == best)
+                                            continue;
+                                        float d = distanceSq(seed, x, y);
+                                        if (d < bestDistanceSq)
+                                        {
+                                            best = seed;
+                                            bestDistanceSq = d;
+                                        }
+                                    }
+                                }
+                                next[(size_t)y * width + x] = best;
+                            }
+                        }
+                    });
+                nearest.swap(next);
+            }
+
+            forEachRasterBand(height, threadCount,
+                [&](int firstRow, int endRow)
+                {
+                    for (int y = firstRow; y < endRow; ++y)
+                    {
+                        for (int x = 0; x < width; ++x)
+                        {
+                            const size_t i = (size_t)y * width + x;
+                            int32_t best = nearest[i];
+                            if (best < 0)
+                            {
+                                labels[i] = rasterNoCell;
+                                continue;
+                            }
+                            float bestDistanceSq = distanceSq(best, x, y);
+                            for (int32_t site = -1; site != best; )
+                            {
+                                site = best;
+                                for (int32_t k = neighborStart[site];
+                                     k < neighborStart[site + 1]; ++k)
+                                {
+                                    float d = distanceSq(neighbors[k], x, y);
+                                    if (d < bestDistanceSq)
+                                    {
+                                        best = neighbors[k];
+                                        bestDistanceSq = d;
+                                    }
+                                }
+                            }
+                            labels[i] = (uint32_t)graph.siteCell(best);
+                        }
+                    }
+                });
+        }
+    }
+
+    //  Fills labels (resized to width * height, row major) with the cell
+    //  index covering each pixel, or rasterNoCell.
+    inline void rasterizeCells(const Graph& graph,
+                               std::vector<uint32_t>& labels,
+                               int width, int height,
+                               RasterMethod method = RasterMethod::Auto,
+                               unsigned threadCount = 1)
+    {
+        labels.assign((size_t)std::max(0, width) * std::max(0, height),
+                      rasterNoCell);
+        if (labels.empty() || graph.xBound() <= 0.0f ||
+            graph.yBound() <= 0.0f)
+            return;
+
+        if (method == RasterMethod::Auto)
+        {
+            const float sitesPerPixel =
+                graph.siteCount() / ((float)width * height);
+            method = sitesPerPixel > rasterAutoSitesPerPixel &&
+                     graph.nearestSiteCells()
+                ? RasterMethod::JumpFlood
+                : RasterMethod::Scanline;
+        }
+
+        if (method == RasterMethod::JumpFlood)
+            detail::rasterizeJumpFlood(graph, labels, width, height,
+                                       threadCount);
+        else
+            detail::rasterizeScanline(graph, labels, width, height,
+                                      threadCount);
+    }
+
+    //  Fills distances (resized to width * height, row major) with the
+    //  distance, in graph units, from each pixel's centre to the site of
+    //  the cell covering it, or infinity where no cell does.  Also fills
+    //  labels as rasterizeCells(Scanline) would when given.
+    inline void distanceField(const Graph& graph,
+                              std::vector<float>& distances,
+                              int width, int height,
+                              unsigned threadCount = 1,
+                              std::vector<uint32_t>* labels = nullptr)
+    {
+        const size_t pixelCount =
+            (size_t)std::max(0, width) * std::max(0, height);
+        distances.assign(pixelCount,
+                         std::numeric_limits<float>::infinity());
+        if (labels)
+            labels->assign(pixelCount, rasterNoCell);
+        if (!pixelCount || graph.xBound() <= 0.0f ||
+            graph.yBound() <= 0.0f)
+            return;
+
+        const Cells& cells = graph.cells();
+        const float pixelWidth = graph.xBound() / width;
+        const float pixelHeight = graph.yBound() / height;
+        detail::forEachCellSpan(graph, width, height, threadCount,
+            [&](int32_t cell, int row, int x0, int x1)
+            {
+                const Vertex site = graph.sitePosition(cells[cell].site);
+                const float dy = (row + 0.5f) * pixelHeight - site.y;
+                const size_t first = (size_t)row * width + x0;
+                detail::distanceSpan(&distances[first], x1 - x0,
+                                     (x0 + 0.5f) * pixelWidth - site.x,
+                                     pixelWidth, dy*dy);
+                if (labels)
+                {
+                    std::fill(labels->begin() + first,
+                              labels->begin() + first + (x1 - x0),
+                              (uint32_t)cell);
+                }
+            });
+    }
+
+    }   // namespace voronoi
+}   // namespace cinekine
+
+#endif
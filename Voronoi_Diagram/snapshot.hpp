@@ -0,0 +1,215 @@
+#ifndef CK_VORONOI_SNAPSHOT_HPP
+#define CK_VORONOI_SNAPSHOT_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "voronoi.hpp"
+
+//  Versioned Graph snapshots with RCU-style publication.
+//
+//  A GraphSnapshots holder owns a small ring of slots, one of which is
+//  current.  Readers pin the current slot by bumping its reader count and
+//  confirming it is still current; they never take a lock and only retry
+//  if a publish lands in between.  A writer moves a freshly built Graph
+//  into a slot nobody is reading, then swaps it in as current.  An old
+//  version is reclaimed once its last reader lets go and the writer needs
+//  the slot (or calls reclaim().)
+//
+//  Readers:
+//      auto snapshot = snapshots.acquire();
+//      query(snapshot.graph());
+//
+//  Writer (background thread):
+//      snapshots.publish(build(std::move(sites), xBound, yBound));
+//
+//  The slot count bounds how many versions may be alive at once: publish()
+//  yields until some non-current slot is free, so a reader holding on to
+//  a snapshot across several rebuilds stalls the writer, never the other
+//  readers.
+
+namespace cinekine
+{
+    namespace voronoi
+    {
+
+    /**
+     * @class GraphSnapshots
+     * @brief Holds the published Graph and hands out immutable snapshots
+     *        of it to concurrent readers.
+     */
+    class GraphSnapshots
+    {
+        struct Slot
+        {
+            std::atomic<int> readers;
+            uint64_t version;
+            Graph graph;
+
+            Slot() : readers(0), version(0) {}
+        };
+
+    public:
+        /**
+         * @class Snapshot
+         * @brief Pins one published Graph version for as long as it lives
+         */
+        class Snapshot
+        {
+        public:
+            Snapshot() : _slot(nullptr) {}
+            Snapshot(Snapshot&& other) : _slot(other._slot) {
+                other._slot = nullptr;
+            }
+            Snapshot& operator=(Snapshot&& other) {
+                if (this != &other)
+                {
+                    release();
+                    _slot = other._slot;
+                    other._slot = nullptr;
+                }
+                return *this;
+            }
+            ~Snapshot() { release(); }
+
+            Snapshot(const Snapshot&) = delete;
+            Snapshot& operator=(const Snapshot&) = delete;
+
+            //  false for a default constructed or moved-from snapshot
+            explicit operator bool() const { return _slot != nullptr; }
+
+            const Graph& graph() const { return _slot->graph; }
+            const Graph& operator*() const { return _slot->graph; }
+            const Graph* operator->() const { return &_slot->graph; }
+            //  0 for the empty graph a holder starts out with
+            uint64_t version() const { return _slot->version; }
+
+            void release() {
+                if (_slot)
+                {
+                    _slot->readers.fetch_sub(1, std::memory_order_release);
+                    _slot = nullptr;
+                }
+            }
+
+        private:
+            friend class GraphSnapshots;
+            explicit Snapshot(Slot* slot) : _slot(slot) {}
+
+            Slot* _slot;
+        };
+
+        //  slotCount is clamped to at least 2 (the current version and one
+        //  to build the next into.)
+        explicit GraphSnapshots(unsigned slotCount = 4);
+
+        GraphSnapshots(const GraphSnapshots&) = delete;
+        GraphSnapshots& operator=(const GraphSnapshots&) = delete;
+
+        //  Pins and returns the current version.  Lock-free; safe to call
+        //  from any number of threads concurrently with publish().
+        Snapshot acquire() const;
+
+        //  Makes graph the current version and returns its version number.
+        //  Publishers are serialized among themselves; readers are never
+        //  blocked.
+        uint64_t publish(Graph&& graph);
+
+        //  Frees the graphs of superseded versions that no reader holds.
+        void reclaim();
+
+        uint64_t version() const;
+
+    private:
+        //  the only fences that matter are the reader's increment against
+        //  its reload of _current, and the writer's store of _current
+        //  against its load of a slot's reader count, so both sides use
+        //  sequentially consistent operations there.
+        std::unique_ptr<Slot[]> _slots;
+        unsigned _slotCount;
+        std::atomic<unsigned> _current;
+        uint64_t _version;
+        std::mutex _publishMutex;
+    };
+
+    inline GraphSnapshots::GraphSnapshots(unsigned slotCount) :
+        _slots(new Slot[slotCount < 2 ? 2 : slotCount]),
+        _slotCount(slotCount < 2 ? 2 : slotCount),
+        _current(0),
+        _version(0)
+    {
+    }
+
+    inline GraphSnapshots::Snapshot GraphSnapshots::acquire() const
+    {
+        for (;;)
+        {
+            unsigned current = _current.load();
+            Slot& slot = _slots[current];
+            slot.readers.fetch_add(1);
+            //  the slot might have been superseded (and handed to the
+            //  writer) between the load and the increment; only a slot
+            //  that is still current after the increment is safe to read
+            if (_current.load() == current)
+                return Snapshot(&slot);
+            slot.readers.fetch_sub(1, std::memory_order_release);
+        }
+    }
+
+    inline uint64_t GraphSnapshots::publish(Graph&& graph)
+    {
+        std::lock_guard<std::mutex> lock(_publishMutex);
+
+        const unsigned current = _current.load(std::memory_order_relaxed);
+        unsigned target = current;
+        for (;;)
+        {
+            for (unsigned i = 1; i < _slotCount; ++i)
+            {
+                unsigned slot = (current + i) % _slotCount;
+                if (_slots[slot].readers.load() == 0)
+                {
+                    target = slot;
+                    break;
+                }
+            }
+            if (target != current)
+                break;
+            std::this_thread::yield();
+        }
+
+        //  a reader may still bump target's count transiently, but it
+        //  backs off without touching the graph since target isn't current
+        Slot& slot = _slots[target];
+        std::atomic_thread_fence(std::memory_order_acquire);
+        slot.graph = std::move(graph);
+        slot.version = ++_version;
+        _current.store(target);
+        return slot.version;
+    }
+
+    inline void GraphSnapshots::reclaim()
+    {
+        std::lock_guard<std::mutex> lock(_publishMutex);
+
+        const unsigned current = _current.load(std::memory_order_relaxed);
+        for (unsigned i = 0; i < _slotCount; ++i)
+        {
+            if (i == current || _slots[i].readers.load() != 0)
+                continue;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            _slots[i].graph = Graph();
+        }
+    }
+
+    inline uint64_t GraphSnapshots::version() const
+    {
+        return acquire().version();
+    }
+
+    }   // namespace voronoi
+}   // namespace cinekine
+
+#endif
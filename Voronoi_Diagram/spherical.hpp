@@ -0,0 +1,471 @@
+#ifndef CK_VORONOI_SPHERICAL_HPP
+#define CK_VORONOI_SPHERICAL_HPP
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "voronoi.hpp"
+
+//  Voronoi diagrams of sites on the sphere.
+//
+//  The spherical Delaunay triangulation is the convex hull of the sites'
+//  unit vectors.  Stereographic projection from one of the sites (the
+//  pole) maps circles on the sphere to circles in the plane, or to lines
+//  for circles through the pole, so a cap holding no site becomes a disk
+//  holding no site.  The planar Delaunay triangulation of the other sites,
+//  read off a single build(), is therefore the spherical one less the
+//  pole's triangles, and the pole neighbours exactly the planar convex
+//  hull.  A cell has a vertex per pair of consecutive neighbours around
+//  its site: the centre of the three sites' circumcircle on the sphere.
+//  One O(n log n) sweep and a hull cover the whole sphere; nothing is cut
+//  at the antimeridian or the poles, and nothing needs stitching.
+//
+//  Sites are given as longitude (x) and latitude (y) in degrees, on the
+//  unit sphere.  Edges are geodesic, arcs of the great circle bisecting
+//  their two sites.
+//
+//  The sweep runs on float coordinates (with Robustness::Adaptive, since
+//  the projection spans many scales), which resolves sites down to some
+//  1e-6 radians apart, a few metres on the Earth.
+
+namespace cinekine
+{
+    namespace voronoi
+    {
+
+    /**
+     * @struct SpherePoint
+     * @brief  A point on the unit sphere
+     */
+    struct SpherePoint
+    {
+        double x, y, z;
+    };
+
+    //  (longitude, latitude) in degrees to a point on the unit sphere
+    SpherePoint spherePoint(const Vertex& lonLat);
+    //  a point on the unit sphere to (longitude, latitude) in degrees
+    Vertex lonLat(const SpherePoint& point);
+
+    /**
+     * @struct SphericalEdge
+     * @brief  The arc of the great circle bisecting leftSite and rightSite
+     *         from vertex v0 to vertex v1, leftSite on its left seen from
+     *         outside the sphere.
+     *
+     * Between just two sites it is the whole great circle, v0 = v1 = -1.
+     */
+    struct SphericalEdge
+    {
+        int v0, v1;
+        int leftSite, rightSite;
+    };
+
+    /**
+     * @struct SphericalCell
+     * @brief  A site's region of the sphere
+     *
+     * Side i runs from vertices[i] to vertices[i+1] (the last back to the
+     * first), counterclockwise seen from outside, along edges[i], which
+     * it shares with the cell of site neighbors[i].
+     */
+    struct SphericalCell
+    {
+        int site;
+        std::vector<int> vertices;
+        std::vector<int> neighbors;
+        std::vector<int> edges;
+    };
+
+    /**
+     * @class SphericalGraph
+     * @brief A Voronoi diagram of sites on the sphere
+     *
+     * There is one cell per distinct site, in order of the sites' first
+     * appearance; a lone site's cell is the whole sphere, with no sides.
+     */
+    class SphericalGraph
+    {
+    public:
+        //  the sites as given, on the unit sphere
+        const std::vector<SpherePoint>& sites() const {
+            return _sites;
+        }
+        //  the site's cell, -1 if it repeats an earlier site
+        int siteCell(int site) const {
+            return _siteCells[site];
+        }
+        const std::vector<SphericalCell>& cells() const {
+            return _cells;
+        }
+        const std::vector<SpherePoint>& vertices() const {
+            return _vertices;
+        }
+        const std::vector<SphericalEdge>& edges() const {
+            return _edges;
+        }
+
+    private:
+        friend SphericalGraph buildSpherical(const Sites& sites);
+
+        std::vector<SpherePoint> _sites;
+        std::vector<int> _siteCells;
+        std::vector<SphericalCell> _cells;
+        std::vector<SpherePoint> _vertices;
+        std::vector<SphericalEdge> _edges;
+    };
+
+    //  Builds the spherical Voronoi diagram of sites given as (longitude,
+    //  latitude) in degrees.
+    SphericalGraph buildSpherical(const Sites& sites);
+
+    inline SpherePoint spherePoint(const Vertex& lonLat)
+    {
+        const double degrees = 3.14159265358979323846 / 180.0;
+        //  every longitude names the same pole
+        if (std::abs(lonLat.y) >= 90.0f)
+        {
+            SpherePoint pole = { 0.0, 0.0, lonLat.y > 0.0f ? 1.0 : -1.0 };
+            return pole;
+        }
+        const double lon = lonLat.x * degrees, lat = lonLat.y * degrees;
+        SpherePoint point = {
+            std::cos(lat) * std::cos(lon),
+            std::cos(lat) * std::sin(lon),
+            std::sin(lat)
+        };
+        return point;
+    }
+
+    inline Vertex lonLat(const SpherePoint& point)
+    {
+        const double degrees = 180.0 / 3.14159265358979323846;
+        return Vertex((float)(std::atan2(point.y, point.x) * degrees),
+                      (float)(std::atan2(point.z,
+                                         std::sqrt(point.x*point.x +
+                                                   point.y*point.y)) *
+                              degrees));
+    }
+
+    namespace detail
+    {
+        inline SpherePoint sphereSub(const SpherePoint& a,
+                                     const SpherePoint& b)
+        {
+            SpherePoint d = { a.x - b.x, a.y - b.y, a.z - b.z };
+            return d;
+        }
+
+        inline double sphereDot(const SpherePoint& a, const SpherePoint& b)
+        {
+            return a.x*b.x + a.y*b.y + a.z*b.z;
+        }
+
+        inline SpherePoint sphereCross(const SpherePoint& a,
+                                       const SpherePoint& b)
+        {
+            SpherePoint c = {
+                a.y*b.z - a.z*b.y,
+                a.z*b.x - a.x*b.z,
+                a.x*b.y - a.y*b.x
+            };
+            return c;
+        }
+
+        inline SpherePoint sphereNormalize(const SpherePoint& a)
+        {
+            const double length = std::sqrt(sphereDot(a, a));
+            SpherePoint n = { a.x / length, a.y / length, a.z / length };
+            return n;
+        }
+
+        //  a unit vector perpendicular to a
+        inline SpherePoint spherePerpendicular(const SpherePoint& a)
+        {
+            SpherePoint axis = { 0.0, 0.0, 0.0 };
+            if (std::abs(a.x) <= std::abs(a.y) && std::abs(a.x) <= std::abs(a.z))
+                axis.x = 1.0;
+            else if (std::abs(a.y) <= std::abs(a.z))
+                axis.y = 1.0;
+            else
+                axis.z = 1.0;
+            return sphereNormalize(sphereCross(a, axis));
+        }
+    }
+
+    inline SphericalGraph buildSpherical(const Sites& sites)
+    {
+        using namespace detail;
+
+        SphericalGraph graph;
+        const int siteCount = (int)sites.size();
+        graph._sites.reserve(siteCount);
+        for (auto& site : sites)
+            graph._sites.push_back(spherePoint(site));
+
+        //  one cell per distinct point, in order of first appearance
+        std::vector<int> order(siteCount);
+        for (int i = 0; i < siteCount; ++i)
+            order[i] = i;
+        const std::vector<SpherePoint>& points = graph._sites;
+        auto less = [&points](int a, int b)
+        {
+            const SpherePoint& p = points[a];
+            const SpherePoint& q = points[b];
+            if (p.x != q.x) return p.x < q.x;
+            if (p.y != q.y) return p.y < q.y;
+            if (p.z != q.z) return p.z < q.z;
+            return a < b;
+        };
+        std::sort(order.begin(), order.end(), less);
+        graph._siteCells.assign(siteCount, -1);
+        std::vector<int> firstOf(siteCount);
+        for (int i = 0; i < siteCount; ++i)
+        {
+            const bool repeat = i > 0 &&
+                                points[order[i-1]].x == points[order[i]].x &&
+                                points[order[i-1]].y == points[order[i]].y &&
+                                points[order[i-1]].z == points[order[i]].z;
+            firstOf[order[i]] = repeat ? firstOf[order[i-1]] : order[i];
+        }
+        std::vector<int> cellSites;
+        for (int i = 0; i < siteCount; ++i)
+        {
+            if (firstOf[i] == i)
+            {
+                graph._siteCells[i] = (int)cellSites.size();
+                cellSites.push_back(i);
+            }
+        }
+        const int cellCount = (int)cellSites.size();
+        graph._cells.resize(cellCount);
+        for (int c = 0; c < cellCount; ++c)
+            graph._cells[c].site = cellSites[c];
+        if (cellCount < 2)
+            return graph;
+
+        if (cellCount == 2)
+        {
+            SphericalEdge edge = { -1, -1, cellSites[0], cellSites[1] };
+            graph._edges.push_back(edge);
+            graph._cells[0].neighbors.push_back(cellSites[1]);
+            graph._cells[0].edges.push_back(0);
+            graph._cells[1].neighbors.push_back(cellSites[0]);
+            graph._cells[1].edges.push_back(0);
+            return graph;
+        }
+
+        //  project the other cells' sites stereographically from the
+        //  first, scaled so sites around the far side of the sphere are
+        //  about a unit apart.  1 - z is taken as |p - pole|^2 / 2, which
+        //  keeps its precision next to the pole.
+        const SpherePoint pole = points[cellSites[0]];
+        const SpherePoint e1 = spherePerpendicular(pole);
+        const SpherePoint e2 = sphereCross(pole, e1);
+        const double scale = std::sqrt((double)cellCount);
+        Sites projected;
+        projected.reserve(cellCount - 1);
+        for (int c = 1; c < cellCount; ++c)
+        {
+            const SpherePoint& p = points[cellSites[c]];
+            const SpherePoint d = sphereSub(p, pole);
+            const double k = 2.0 * scale / sphereDot(d, d);
+            projected.emplace_back(Vertex((float)(sphereDot(p, e1) * k),
+                                          (float)(sphereDot(p, e2) * k)));
+        }
+
+        //  the pole's neighbours: the planar hull, by monotone chain
+        //  (collinear sites left out; they lie on a circle through the
+        //  pole with the hull's corners, so share their vertices)
+        std::vector<int> byX(cellCount - 1);
+        for (int i = 0; i < cellCount - 1; ++i)
+            byX[i] = i;
+        std::sort(byX.begin(), byX.end(), [&projected](int a, int b)
+        {
+            return projected[a].x < projected[b].x ||
+                   (projected[a].x == projected[b].x &&
+                    projected[a].y < projected[b].y);
+        });
+        auto turn = [&projected](int o, int a, int b)
+        {
+            return ((double)projected[a].x - projected[o].x) *
+                   ((double)projected[b].y - projected[o].y) -
+                   ((double)projected[a].y - projected[o].y) *
+                   ((double)projected[b].x - projected[o].x);
+        };
+        std::vector<int> hull;
+        for (int pass = 0; pass < 2; ++pass)
+        {
+            const size_t base = hull.size();
+            for (int i = 0; i < cellCount - 1; ++i)
+            {
+                const int p = pass ? byX[cellCount - 2 - i] : byX[i];
+                while (hull.size() >= base + 2 &&
+                       turn(hull[hull.size()-2], hull.back(), p) <= 0.0)
+                    hull.pop_back();
+                hull.push_back(p);
+            }
+            hull.pop_back();
+        }
+        if (hull.empty())
+            hull.push_back(byX[0]);
+
+        //  Delaunay adjacency over cells: the sweep's edges, cell c being
+        //  projected site c-1, plus the pole's
+        std::vector<std::vector<int>> adjacent(cellCount);
+        {
+            BuildOptions options;
+            options.robustness = Robustness::Adaptive;
+            Graph plane = build(std::move(projected), 1.0f, 1.0f, options);
+            for (auto& edge : plane.edges())
+            {
+                if (edge.leftSite < 0 || edge.rightSite < 0 ||
+                    edge.leftSite == edge.rightSite)
+                    continue;
+                adjacent[edge.leftSite + 1].push_back(edge.rightSite + 1);
+                adjacent[edge.rightSite + 1].push_back(edge.leftSite + 1);
+            }
+        }
+        for (int h : hull)
+        {
+            adjacent[0].push_back(h + 1);
+            adjacent[h + 1].push_back(0);
+        }
+
+        //  each cell's neighbours counterclockwise around its site, seen
+        //  from outside.  The hull edges from the site form a convex cone;
+        //  sorted by angle about an axis inside it (the sum of their
+        //  directions) they come in order even when the hull doesn't hold
+        //  the sphere's centre and the site's own axis is outside.
+        std::vector<std::pair<double, int>> around;
+        for (int c = 0; c < cellCount; ++c)
+        {
+            std::vector<int>& ring = adjacent[c];
+            std::sort(ring.begin(), ring.end());
+            ring.erase(std::unique(ring.begin(), ring.end()), ring.end());
+
+            const SpherePoint& site = points[cellSites[c]];
+            SpherePoint axis = { 0.0, 0.0, 0.0 };
+            for (int n : ring)
+            {
+                const SpherePoint d =
+                    sphereNormalize(sphereSub(site, points[cellSites[n]]));
+                axis.x += d.x;
+                axis.y += d.y;
+                axis.z += d.z;
+            }
+            if (sphereDot(axis, axis) == 0.0)
+                axis = site;
+            axis = sphereNormalize(axis);
+            const SpherePoint t1 = spherePerpendicular(axis);
+            const SpherePoint t2 = sphereCross(axis, t1);
+            around.clear();
+            for (int n : ring)
+            {
+                const SpherePoint d = sphereSub(points[cellSites[n]], site);
+                around.push_back(std::make_pair(
+                    std::atan2(sphereDot(d, t2), sphereDot(d, t1)), n));
+            }
+            std::sort(around.begin(), around.end());
+            for (size_t i = 0; i < ring.size(); ++i)
+                ring[i] = around[i].second;
+        }
+
+        //  a vertex per triangle of consecutive neighbours, (c, ring[i],
+        //  ring[i+1]), made by its lowest cell and looked up by the others
+        //  from the same triangle in that cell's ring
+        std::vector<std::vector<int>> slotVertex(cellCount);
+        auto next = [&adjacent](int c, size_t i)
+        {
+            return adjacent[c][(i + 1) % adjacent[c].size()];
+        };
+        auto slotOf = [&adjacent](int c, int n)
+        {
+            const std::vector<int>& ring = adjacent[c];
+            return (size_t)(std::find(ring.begin(), ring.end(), n) -
+                            ring.begin());
+        };
+        auto addVertex = [&graph, &points, &cellSites](int a, int b, int c)
+        {
+            const SpherePoint& pa = points[cellSites[a]];
+            graph._vertices.push_back(sphereNormalize(sphereCross(
+                sphereSub(points[cellSites[b]], pa),
+                sphereSub(points[cellSites[c]], pa))));
+            return (int)graph._vertices.size() - 1;
+        };
+        for (int c = 0; c < cellCount; ++c)
+        {
+            const std::vector<int>& ring = adjacent[c];
+            slotVertex[c].assign(ring.size(), -1);
+            for (size_t i = 0; i < ring.size(); ++i)
+            {
+                if (c < ring[i] && c < next(c, i))
+                    slotVertex[c][i] = addVertex(c, ring[i], next(c, i));
+            }
+        }
+        for (int c = 0; c < cellCount; ++c)
+        {
+            const std::vector<int>& ring = adjacent[c];
+            for (size_t i = 0; i < ring.size(); ++i)
+            {
+                if (slotVertex[c][i] >= 0)
+                    continue;
+                //  rotate the triangle to start at its lowest cell
+                int a = ring[i], b = next(c, i), third = c;
+                if (b < a)
+                {
+                    std::swap(a, b);
+                    std::swap(b, third);
+                }
+                const size_t slot = slotOf(a, b);
+                if (slot < adjacent[a].size() && next(a, slot) == third)
+                    slotVertex[c][i] = slotVertex[a][slot];
+                else
+                    slotVertex[c][i] = addVertex(c, ring[i], next(c, i));
+            }
+        }
+
+        //  sides: the side along neighbour ring[i] runs between the
+        //  vertices of the triangles either side of it
+        std::vector<std::vector<int>> slotEdge(cellCount);
+        for (int c = 0; c < cellCount; ++c)
+        {
+            const std::vector<int>& ring = adjacent[c];
+            const size_t count = ring.size();
+            SphericalCell& cell = graph._cells[c];
+            slotEdge[c].assign(count, -1);
+            cell.vertices.reserve(count);
+            cell.neighbors.reserve(count);
+            cell.edges.reserve(count);
+            for (size_t i = 0; i < count; ++i)
+            {
+                const int v0 = slotVertex[c][(i + count - 1) % count];
+                const int v1 = slotVertex[c][i];
+                const int n = ring[i];
+                int edge;
+                if (c < n)
+                {
+                    SphericalEdge created = { v0, v1, cellSites[c],
+                                              cellSites[n] };
+                    graph._edges.push_back(created);
+                    edge = (int)graph._edges.size() - 1;
+                    slotEdge[c][i] = edge;
+                }
+                else
+                {
+                    const size_t slot = slotOf(n, c);
+                    edge = slot < slotEdge[n].size() ? slotEdge[n][slot] : -1;
+                }
+                cell.vertices.push_back(v0);
+                cell.neighbors.push_back(cellSites[n]);
+                cell.edges.push_back(edge);
+            }
+        }
+
+        return graph;
+    }
+
+    }   // namespace voronoi
+}   // namespace cinekine
+
+#endif
@@ -8,6 +8,12 @@
 #include <limits>
 #include <algorithm>
 #include <iostream>
+#include <thread>
+#include <map>
+#include <tuple>
+#include <queue>
+#include <functional>
+#include "predicates.hpp"
 using namespace std;
 
 namespace cinekine
@@ -563,6 +569,11 @@ namespace cinekine
      * @brief  Defines an edge of a Voronoi Cell and its placement
      *         relative to other Sites
      * Note that p0 and p1 are invalid unless explicitly set
+     *
+     * In a periodic graph p0 and p1 are given in the frame of leftSite;
+     * wrapX/wrapY are the periods (in bounds units) separating the copy of
+     * rightSite across this edge from rightSite itself.  They are zero
+     * otherwise.
      */
     struct Edge
     {
@@ -571,16 +582,20 @@ namespace cinekine
         int leftSite;
         int midSite;
         int rightSite;
+        short wrapX;
+        short wrapY;
 
         Edge(int lSite, int rSite) :
             leftSite(lSite), rightSite(rSite),
             p0(Vertex::undefined),
-            p1(Vertex::undefined) {}
+            p1(Vertex::undefined),
+            wrapX(0), wrapY(0) {}
 
         Edge() :
             leftSite(-1), rightSite(-1),
             p0(Vertex::undefined),
-            p1(Vertex::undefined) {}
+            p1(Vertex::undefined),
+            wrapX(0), wrapY(0) {}
 
         void setEndpoint(int lSite, int rSite,
                          const Vertex& vertex);
@@ -628,9 +643,27 @@ namespace cinekine
         int site;
         int face;
         int edge;
+        //  sort key around the site: atan2 radians, or a pseudo-angle in
+        //  [-2,2] when built with HalfEdgeOrder::PseudoAngle
         float angle;
     };
 
+    //  A monotone (non-strict) stand-in for atan2(dy, dx), mapping
+    //  [-pi, pi] onto [-2, 2] with a division instead of a transcendental
+    //  call.  Directions atan2 orders one way are never ordered the other
+    //  way here, but nearby ones may tie once dy / sum rounds.  The sign
+    //  of dy decides the side as it does for atan2, -0.0 included.
+    inline float pseudoAngle(float dy, float dx)
+    {
+        float sum = std::abs(dx) + std::abs(dy);
+        if (sum == 0.0f)
+            return 0.0f;
+        float p = dy / sum;
+        if (dx >= 0.0f)
+            return p;
+        return std::signbit(dy) ? -2.0f - p : 2.0f - p;
+    }
+
     /** A half edges container */
     typedef std::vector<HalfEdge> HalfEdges;
 
@@ -655,6 +688,44 @@ namespace cinekine
             closeMe(false) {}
     };
 
+    /**
+     * @struct SiteView
+     * @brief  Read-only site coordinates held by the caller (for instance
+     *         in a memory-mapped file.)
+     *
+     * Site i is at (x[i], y[i]) where each array advances stride bytes
+     * per site: x = data, y = data + 1 and stride = 2*sizeof(float) view
+     * interleaved float pairs, stride = sizeof(float) separate arrays.
+     */
+    struct SiteView
+    {
+        const float* x;
+        const float* y;
+        size_t count;
+        size_t stride;
+
+        SiteView() : x(nullptr), y(nullptr), count(0), stride(0) {}
+        SiteView(const float* xs, const float* ys, size_t n, size_t bytes) :
+            x(xs), y(ys), count(n), stride(bytes) {}
+    };
+
+    /**
+     * @struct Segment
+     * @brief  A line segment, sampled into point sites by
+     *         buildSampledSegments
+     */
+    struct Segment
+    {
+        Vertex p0;
+        Vertex p1;
+
+        Segment() = default;
+        Segment(const Vertex& v0, const Vertex& v1) : p0(v0), p1(v1) {}
+    };
+
+    /** A segments container */
+    typedef std::vector<Segment> Segments;
+
     /** An edges container */
     typedef std::vector<Edge> Edges;
     /** A Site container */
@@ -662,7 +733,222 @@ namespace cinekine
     /** A cells container */
     typedef std::vector<Cell> Cells;
 
+    /**
+     * @enum  Robustness
+     * @brief How the sweep decides the sign of its geometric tests
+     *
+     * Epsilon compares float determinants and breakpoints against fixed
+     * tolerances (min_e).  Adaptive uses the exact-sign predicates from
+     * predicates.hpp with a floating-point filter, so degenerate input
+     * (grids, cocircular sites) is classified exactly, and keeps edges
+     * shorter than min_e that Epsilon drops.
+     */
+    enum class Robustness
+    {
+        Epsilon,
+        Adaptive
+    };
+
+    /**
+     * @enum  HalfEdgeOrder
+     * @brief How half edges are keyed when sorting them around their site
+     *
+     * Angle calls atan2 per half edge.  PseudoAngle uses pseudoAngle(),
+     * which never reverses atan2's counterclockwise order but may tie
+     * nearly parallel directions, for a fraction of the cost;
+     * HalfEdge::angle then holds the pseudo-angle, not radians.
+     */
+    enum class HalfEdgeOrder
+    {
+        Angle,
+        PseudoAngle
+    };
+
+    /**
+     * @enum  BeachlineSearch
+     * @brief Where a site event starts looking for the arc above its site
+     *
+     * Root descends the beachline tree, O(log n) per site.  Finger walks
+     * from the arc added by the previous site event, giving up once the
+     * walk is as long as a descent would be; when consecutive sites (in
+     * sweep order) are close in x, as along scan lines, most sites are
+     * placed within a step or two.
+     */
+    enum class BeachlineSearch
+    {
+        Root,
+        Finger
+    };
+
+    /**
+     * @enum  Metric
+     * @brief The distance cells are measured with
+     *
+     * Manhattan is |dx| + |dy| and Chebyshev max(|dx|, |dy|).  Their
+     * bisectors bend, so a pair of cells may share several edges, one per
+     * straight piece.  Only buildMetric takes a metric; the sweep, and so
+     * build(), is Euclidean.
+     */
+    enum class Metric
+    {
+        Euclidean,
+        Manhattan,
+        Chebyshev
+    };
+
+    /**
+     * @struct BuildOptions
+     * @brief  Optional behaviours of build()
+     */
+    struct BuildOptions
+    {
+        Robustness robustness;
+        HalfEdgeOrder halfEdgeOrder;
+        BeachlineSearch beachlineSearch;
+        //  threads used by clipEdges/closeCells; 0 or 1 runs serially.
+        //  the result does not depend on the thread count.
+        unsigned finalizeThreads;
+        //  treat the bounds as a torus (see buildPeriodic)
+        bool periodic;
+        //  compute per-cell area, centroid, perimeter and bounds while
+        //  closing cells (see Graph::cellMetrics)
+        bool cellMetrics;
+        //  drop clipped away edges once the graph is built (see
+        //  Graph::compact)
+        bool compact;
+        //  link the half edges of the closed cells into a doubly connected
+        //  edge list (see Graph::topology)
+        bool topology;
+
+        BuildOptions() :
+            robustness(Robustness::Epsilon),
+            halfEdgeOrder(HalfEdgeOrder::Angle),
+            beachlineSearch(BeachlineSearch::Root),
+            finalizeThreads(0),
+            periodic(false),
+            cellMetrics(false),
+            compact(false),
+            topology(false) {}
+    };
+
+    /**
+     * @struct CellMetrics
+     * @brief  Per-cell measurements, one entry per Cell (indexed like
+     *         Graph::cells()), stored as parallel arrays.
+     *
+     * Cells without any edges have zero area and perimeter, a centroid at
+     * their site and degenerate bounds at their site.
+     */
+    struct CellMetrics
+    {
+        std::vector<float> area;
+        std::vector<float> centroidX;
+        std::vector<float> centroidY;
+        std::vector<float> perimeter;
+        std::vector<float> minX;
+        std::vector<float> minY;
+        std::vector<float> maxX;
+        std::vector<float> maxY;
+
+        void resize(size_t count);
+        void clear();
+    };
+
+    /**
+     * @struct Topology
+     * @brief  The cells' half edges as a doubly connected edge list.
+     *
+     * Half edges are numbered across all cells: those of cell c are
+     * [cellHalfEdges[c], cellHalfEdges[c+1]), in Cell::halfEdges order
+     * (counterclockwise), so Graph::halfEdge(h) is found without a search.
+     * Per half edge, stored as parallel arrays:
+     *
+     *  - next/prev: the following and preceding half edges of its cell
+     *  - twin: the half edge of the neighbouring cell sharing its edge, -1
+     *    for edges on the bounds (and, in periodic graphs, for edges
+     *    between a site and one of its own images, stored once per side)
+     *  - origin: the vertex it starts from
+     *
+     * Vertices are identified through the links rather than by position,
+     * so they are shared exactly.  The half edges leaving a vertex are
+     * twin[prev[h]] and next[twin[h]] from one of them, h, clockwise and
+     * counterclockwise; a vertex on the bounds stops either way at a -1.
+     * vertexHalfEdge holds one per vertex.  In a periodic graph a vertex
+     * position is in the frame of that half edge's cell.
+     */
+    struct Topology
+    {
+        std::vector<int> cellHalfEdges;
+        std::vector<int> cell;
+        std::vector<int> next;
+        std::vector<int> prev;
+        std::vector<int> twin;
+        std::vector<int> origin;
+        std::vector<Vertex> vertices;
+        std::vector<int> vertexHalfEdge;
+
+        void clear();
+    };
+
+    //  Runs task(thread) for every thread in [0, threadCount), the calling
+    //  thread taking thread 0, and returns once all of them are done.
+    template<typename Task>
+    void parallelFor(unsigned threadCount, Task task)
+    {
+        std::vector<std::thread> threads;
+        threads.reserve(threadCount);
+        for (unsigned thread = 1; thread < threadCount; ++thread)
+            threads.emplace_back(task, thread);
+        task(0);
+        for (auto& thread : threads)
+            thread.join();
+    }
+
+    /**
+     * @class SiteBuckets
+     * @brief Sites bucketed on a uniform grid over their extent, about two
+     *        to a bucket, to find those in a rectangle (see buildWindow)
+     *
+     * Keeps a reference to the sites, which must outlive it.
+     */
+    class SiteBuckets
+    {
+    public:
+        explicit SiteBuckets(const Sites& sites);
+
+        const Sites& sites() const {
+            return _sites;
+        }
+        //  width and height of a bucket
+        float bucketSize() const {
+            return _size;
+        }
+        //  appends the sites in [minX, maxX] x [minY, maxY] to found
+        void sitesInRect(float minX, float minY, float maxX, float maxY,
+                         std::vector<int>& found) const;
+
+    private:
+        const Sites& _sites;
+        float _x0, _y0, _size;
+        int _columns, _rows;
+        //  bucket b's sites are [_bucketStart[b], _bucketStart[b+1]) of
+        //  _bucketSites, row by row
+        std::vector<int> _bucketStart;
+        std::vector<int> _bucketSites;
+    };
+
     class Fortune;
+    class Graph;
+
+    //  cell polygons, from which metric and farthest point graphs are laid
+    //  out (see MetricCorner)
+    struct MetricCorner;
+    typedef std::vector<MetricCorner> MetricPolygon;
+
+    //  Receives each cell of a streaming build (see buildStreaming) once
+    //  the cell is final
+    typedef std::function<void(const Graph& graph, int32_t cell)>
+            CellCallback;
 
     /**
      * @class Graph
@@ -671,7 +957,10 @@ namespace cinekine
     class Graph
     {
     public:
-    	Graph(float xBound, float yBound, Sites&& sites);
+    	Graph(float xBound, float yBound, Sites&& sites,
+              const BuildOptions& options=BuildOptions());
+        Graph(float xBound, float yBound, const SiteView& sites,
+              const BuildOptions& options=BuildOptions());
         Graph();
         Graph(Graph&& other);
 
@@ -680,34 +969,136 @@ namespace cinekine
         const Cells& cells() const {
             return _cells;
         }
+        //  empty for graphs built from a SiteView; siteCount(),
+        //  sitePosition() and siteCell() work for either
         const Sites& sites() const {
             return _sites;
         }        
+        size_t siteCount() const {
+            return _siteCount;
+        }
+        Vertex sitePosition(int site) const {
+            return Vertex(*(const float*)(_siteX + site*_siteStride),
+                          *(const float*)(_siteY + site*_siteStride));
+        }
+        //  the site's cell, -1 if it has none (a duplicate)
+        int siteCell(int site) const {
+            return *(const int*)(_siteCells + site*_siteCellStride);
+        }
         const Edges& edges() const {
             return _edges;
         }
+        float xBound() const {
+            return _xBound;
+        }
+        float yBound() const {
+            return _yBound;
+        }
+        //  empty unless built with BuildOptions::cellMetrics
+        const CellMetrics& cellMetrics() const {
+            return _cellMetrics;
+        }
+        //  for graphs built by buildWindow, the given site each site is;
+        //  empty otherwise
+        const std::vector<int>& siteSources() const {
+            return _siteSources;
+        }
+        //  whether each site's cell (siteCell()) holds the part of the
+        //  bounds nearest the site, as from build(); false for periodic,
+        //  sampled segment, metric and farthest point graphs
+        bool nearestSiteCells() const {
+            return _nearestSiteCells;
+        }
+        //  empty unless built with BuildOptions::topology (and always for
+        //  buildStreaming, whose cells give up their half edges)
+        const Topology& topology() const {
+            return _topology;
+        }
+        //  a half edge by its Topology number
+        const HalfEdge& halfEdge(int index) const {
+            const int cell = _topology.cell[index];
+            return _cells[cell].halfEdges[index -
+                                          _topology.cellHalfEdges[cell]];
+        }
+
+        //  end points of a half edge as seen from its site, in the site's
+        //  frame for periodic graphs
+        Vertex getHalfEdgeStartpoint(const HalfEdge& halfEdge) const;
+        Vertex getHalfEdgeEndpoint(const HalfEdge& halfEdge) const;
+
+        //  Removes the edges left undefined (or point-like) by clipping,
+        //  renumbering the remaining edges and the half edges referring to
+        //  them, and releases spare capacity.  Edge indices taken before
+        //  compacting are invalidated, as are half edge numbers if any
+        //  half edge had to go (the topology is relinked then.)
+        void compact();
 
     private:
-    	friend Graph build(Sites&& sites, float xBound, float yBound);
+    	friend Graph build(Sites&& sites, float xBound, float yBound,
+                           const BuildOptions& options);
+        friend Graph build(const SiteView& sites, float xBound, float yBound,
+                           const BuildOptions& options);
+        friend Graph buildPeriodic(Sites&& sites, float xBound, float yBound,
+                                   const BuildOptions& options);
+        friend Graph buildSampledSegments(const Segments& segments,
+                                          float xBound, float yBound,
+                                          float tolerance,
+                                          const BuildOptions& options);
+        friend Graph buildStreaming(Sites&& sites, float xBound, float yBound,
+                                    const CellCallback& onCell,
+                                    const BuildOptions& options);
+        friend Graph buildMetric(Sites&& sites, float xBound, float yBound,
+                                 Metric metric, const BuildOptions& options);
+        friend Graph buildFarthest(Sites&& sites, float xBound, float yBound,
+                                   const BuildOptions& options);
+        friend Graph buildWindow(const SiteBuckets& sites,
+                                 float minX, float minY,
+                                 float maxX, float maxY,
+                                 const BuildOptions& options);
         friend class Fortune;
+
+        template<typename CircleDone>
+        void sweep(Fortune& fortune, CircleDone circleDone);
         
+        int newEdge(Edges& edges, int left, int right);
         int createBorderEdge(int site,
                              const Vertex& va, const Vertex& vb);
+        int createBorderEdge(Edges& edges, int site,
+                             const Vertex& va, const Vertex& vb);
+        HalfEdge createBorderHalfEdge(Edges& edges, int edgeBase, int site,
+                                      const Vertex& va, const Vertex& vb);
         HalfEdge createHalfEdge(int edge, int lSite, int rSite);
+        float halfEdgeAngle(float dy, float dx) const;
 
         int createEdge(int left, int right,
                        const Vertex& va=Vertex::undefined,
                        const Vertex& vb=Vertex::undefined);       
 
-        bool connectEdge(int edgeIdx);
+        bool connectEdge(int edgeIdx, bool& bordered);
         void clipEdges();
-        bool clipEdge(int32_t edge);        
+        bool clipEdge(int32_t edge, bool& bordered);
+        bool finalizeEdge(int edgeIdx);
+        bool isPointLike(const Edge& edge) const;
+        void markCellsToClose(int edgeIdx);
         
         void closeCells();
-        Vertex getHalfEdgeStartpoint(const HalfEdge& halfEdge);
+        bool closeCell(int32_t cell, Edges& borderEdges, int edgeBase);
+        void closeCellsParallel(unsigned threadCount);
         bool prepareHalfEdgesForCell(int32_t cell);
-        
-        Vertex getHalfEdgeEndpoint(const HalfEdge& halfEdge);
+        Vertex unwrapVertex(const Vertex& vertex, const Edge& edge) const;
+        void measureCell(int32_t cell);
+        void addPolygonCells(const std::vector<int>& order,
+                             std::vector<MetricPolygon>& polygons,
+                             const std::vector<double>& xs,
+                             const std::vector<double>& ys);
+        void linkHalfEdges();
+        void streamCell(int32_t cell, std::vector<char>& edgeDone,
+                        std::vector<int>& cellEdges,
+                        const CellCallback& onCell);
+        void bindSites();
+        int& siteCellRef(int site) {
+            return *(int*)(_siteCells + site*_siteCellStride);
+        }
 
     private:
     	float starting;
@@ -720,6 +1111,24 @@ namespace cinekine
         Cells _cells;
     
         float _yBound;
+        BuildOptions _options;
+        CellMetrics _cellMetrics;
+        Topology _topology;
+        std::vector<int> _siteSources;
+        bool _nearestSiteCells;
+        //  edges released by a streaming build, for newEdge to reuse
+        std::vector<int> _freeEdges;
+
+        //  site coordinates and cells, strided: into _sites, or into a
+        //  SiteView's arrays and _viewCells
+        SiteView _siteView;
+        std::vector<int> _viewCells;
+        const char* _siteX;
+        const char* _siteY;
+        size_t _siteStride;
+        char* _siteCells;
+        size_t _siteCellStride;
+        size_t _siteCount;
     };
 
     ///////////////////////////////////////////////////////////////////////
@@ -730,15 +1139,18 @@ namespace cinekine
     {
     	float parab;
         BeachArc* arc;
-        float yCenter;
-        float y;
+        //  in double, as Robustness::Adaptive works the centre out: rounded
+        //  to float, events that exact predicates tell apart may tie or
+        //  swap
+        double yCenter;
+        double y;
         int site;
-        float x;
+        double x;
 
         CircleEvent() :
         	site(-1),
             arc(nullptr),            
-            x(0.0f), y(0.0f), yCenter(0.0f) {}
+            x(0.0), y(0.0), yCenter(0.0) {}
     };
 
     struct BeachArc : RBNodeBase<BeachArc>
@@ -760,7 +1172,7 @@ namespace cinekine
     class Fortune
     {
     public:
-        Fortune(Graph& graph);
+        Fortune(Graph& graph, const BuildOptions& options);
         ~Fortune();
 
         void removeBeachSection(BeachArc* arc);
@@ -770,10 +1182,18 @@ namespace cinekine
             return _topCircleEvent;
         }
 
+        //  starts counting each site's arcs, so that sites whose last arc
+        //  leaves the beachline are collected in finishedSites()
+        void trackFinishedSites() {
+            _siteArcs.assign(_graph.siteCount(), 0);
+        }
+        std::vector<int>& finishedSites() {
+            return _finishedSites;
+        }
+
     private:
     	Edges& _edges;
         Graph& _graph;
-        const Sites& _sites;        
 
         RBTree<BeachArc> _beachline;
         CircleEvent* _topCircleEvent;
@@ -781,11 +1201,23 @@ namespace cinekine
 
         int _arcCnt, _circleCnt;
         int parabCnt;
+        Robustness _robustness;
+        BeachlineSearch _beachlineSearch;
+        //  the arc last added (if still on the beachline) and the number
+        //  of arcs on it, for BeachlineSearch::Finger; after failed walks
+        //  the next few site events skip the walk
+        BeachArc* _finger;
+        int _beachArcCnt;
+        int _fingerSkip, _fingerBackoff;
+        std::vector<int> _siteArcs;
+        std::vector<int> _finishedSites;
         
         BeachArc* allocArc(int site) {
             BeachArc* arc = new BeachArc(site);
             ++_arcCnt;
             ++arc->refcnt;
+            if (!_siteArcs.empty())
+                ++_siteArcs[site];
             return arc;
         }
         void releaseArc(BeachArc* arc) {
@@ -828,15 +1260,65 @@ namespace cinekine
         }
 
         void attachCircleEvent(BeachArc* arc);
+        void insertCircleEvent(BeachArc* arc, double x, double yCenter,
+                               double y);
         void detachCircleEvent(BeachArc* arc);
         float leftBreakPoint(BeachArc* arc, float directrix);
         float rightBreakPoint(BeachArc* arc, float directrix);
+        int leftBreakPointSide(BeachArc* arc, float x, float directrix);
+        int rightBreakPointSide(BeachArc* arc, float x, float directrix);
+        bool sharesCircleEvent(const Vertex& vertex, const BeachArc* neighbor,
+                               const BeachArc* far, const Vertex circle[3]);
         void detachBeachSection(BeachArc* arc);        
+        bool findArcsFromFinger(float x, float directrix,
+                                BeachArc*& leftArc, BeachArc*& rightArc);
+        bool walkFromFinger(float x, float directrix,
+                            BeachArc*& leftArc, BeachArc*& rightArc);
     };
 
     //  Builds a graph given a collection of sites and a bounding box
     //  
-    Graph build(Sites&& sites, float xBound, float yBound);
+    Graph build(Sites&& sites, float xBound, float yBound,
+                const BuildOptions& options = BuildOptions());
+
+    //  Builds a graph from site coordinates held by the caller, which are
+    //  neither copied nor modified (see definition.)
+    Graph build(const SiteView& sites, float xBound, float yBound,
+                const BuildOptions& options = BuildOptions());
+
+    //  Builds a graph like build(), handing each cell to onCell as soon as
+    //  it is final (see definition.)
+    Graph buildStreaming(Sites&& sites, float xBound, float yBound,
+                         const CellCallback& onCell,
+                         const BuildOptions& options = BuildOptions());
+
+    //  Builds a periodic graph; build() forwards here when
+    //  BuildOptions::periodic is set.
+    Graph buildPeriodic(Sites&& sites, float xBound, float yBound,
+                        const BuildOptions& options);
+
+    //  Approximates the Voronoi diagram of line segments by sampling them
+    //  (see definition.)
+    Graph buildSampledSegments(const Segments& segments, float xBound,
+                               float yBound, float tolerance,
+                               const BuildOptions& options = BuildOptions());
+
+    //  Builds a graph under the Manhattan or Chebyshev metric, cell by cell
+    //  rather than by the sweep (see definition.)
+    Graph buildMetric(Sites&& sites, float xBound, float yBound,
+                      Metric metric,
+                      const BuildOptions& options = BuildOptions());
+
+    //  Builds the farthest point graph, a cell for each site of the convex
+    //  hull where that site is the farthest (see definition.)
+    Graph buildFarthest(Sites&& sites, float xBound, float yBound,
+                        const BuildOptions& options = BuildOptions());
+
+    //  Builds the cells of the given sites within a window of their plane,
+    //  from the sites near it alone (see definition.)
+    Graph buildWindow(const SiteBuckets& sites, float minX, float minY,
+                      float maxX, float maxY,
+                      const BuildOptions& options = BuildOptions());
 
     }   // namespace voronoi
 }   // namespace cinekine
@@ -853,15 +1335,20 @@ namespace cinekine
                     Vertex(std::numeric_limits<float>::quiet_NaN(),
                            std::numeric_limits<float>::quiet_NaN());
 
-    Fortune::Fortune(Graph& graph) :
-    	_beachline(),
-        _circleEvents(),
+    Fortune::Fortune(Graph& graph, const BuildOptions& options) :
+        _edges(graph._edges),
         _graph(graph),
-        _sites(graph._sites),
-        _edges(graph._edges),        
+    	_beachline(),
         _topCircleEvent(nullptr),
+        _circleEvents(),
         _arcCnt(0),
-        _circleCnt(0)
+        _circleCnt(0),
+        _robustness(options.robustness),
+        _beachlineSearch(options.beachlineSearch),
+        _finger(nullptr),
+        _beachArcCnt(0),
+        _fingerSkip(0),
+        _fingerBackoff(0)
     {
     }
         
@@ -878,7 +1365,7 @@ namespace cinekine
     float Fortune::leftBreakPoint(BeachArc* arc, float directrix)
     {
     	
-        const Site& site = _sites[arc->site];
+        const Vertex site = _graph.sitePosition(arc->site);
         float rfocx = site.x, rfocy = site.y;
         
         float pby2 = rfocy - directrix;
@@ -893,7 +1380,7 @@ namespace cinekine
         else
             return -std::numeric_limits<float>::infinity();
 
-        const Site& leftSite = _sites[leftArc->site];
+        const Vertex leftSite = _graph.sitePosition(leftArc->site);
         float lfocx = leftSite.x, lfocy = leftSite.y;
         
         float plby2 = lfocy - directrix;
@@ -929,12 +1416,86 @@ namespace cinekine
         	
             return leftBreakPoint(rightArc, directrix);
         }
-        const Site& site = _sites[arc->site];
+        const Vertex site = _graph.sitePosition(arc->site);
         
         return site.y == directrix ? site.x :
                std::numeric_limits<float>::infinity();
     }
 
+    //  Where x lies relative to the left break point of arc:
+    //  1 if before it, 0 if on it, -1 if after it.
+    int Fortune::leftBreakPointSide(BeachArc* arc, float x, float directrix)
+    {
+        if (_robustness == Robustness::Epsilon)
+        {
+            float dxl = leftBreakPoint(arc, directrix) - x;
+            return dxl > min_e ? 1 : dxl > -min_e ? 0 : -1;
+        }
+
+        const Vertex site = _graph.sitePosition(arc->site);
+        BeachArc* leftArc = arc->previous();
+        // foci on the directrix and the open left end are exact already
+        if (site.y == directrix || !leftArc)
+        {
+            float xl = leftBreakPoint(arc, directrix);
+            return xl > x ? 1 : xl == x ? 0 : -1;
+        }
+        const Vertex leftSite = _graph.sitePosition(leftArc->site);
+        if (leftSite.y == directrix)
+            return leftSite.x > x ? 1 : leftSite.x == x ? 0 : -1;
+
+        return predicates::breakPointSide(leftSite.x, leftSite.y,
+                                          site.x, site.y,
+                                          x, directrix);
+    }
+
+    //  Where x lies relative to the right break point of arc:
+    //  1 if after it, 0 if on it, -1 if before it.
+    int Fortune::rightBreakPointSide(BeachArc* arc, float x, float directrix)
+    {
+        if (_robustness == Robustness::Epsilon)
+        {
+            float dxr = x - rightBreakPoint(arc, directrix);
+            return dxr > min_e ? 1 : dxr > -min_e ? 0 : -1;
+        }
+
+        BeachArc* rightArc = arc->next();
+        if (rightArc)
+            return -leftBreakPointSide(rightArc, x, directrix);
+
+        const Vertex site = _graph.sitePosition(arc->site);
+        if (site.y != directrix)
+            return -1;
+        return x > site.x ? 1 : x == site.x ? 0 : -1;
+    }
+
+    //  Whether the circle event pending on neighbor (an arc adjacent to the
+    //  collapsing arc) is located at vertex, the collapsing arc's own circle
+    //  event.  Both circles already pass through two common sites, so they
+    //  coincide iff the site beyond the neighbor ('far') lies on the
+    //  collapsing circle.
+    bool Fortune::sharesCircleEvent(const Vertex& vertex,
+                                    const BeachArc* neighbor,
+                                    const BeachArc* far,
+                                    const Vertex circle[3])
+    {
+        const CircleEvent* event = neighbor->circleEvent;
+        if (!event)
+            return false;
+
+        if (_robustness == Robustness::Epsilon || !far)
+        {
+            return std::abs(vertex.x-event->x) < min_e &&
+                   std::abs(vertex.y-event->yCenter) < min_e;
+        }
+
+        const Vertex d = _graph.sitePosition(far->site);
+        return predicates::incircle(circle[0].x, circle[0].y,
+                                    circle[1].x, circle[1].y,
+                                    circle[2].x, circle[2].y,
+                                    d.x, d.y) == 0.0;
+    }
+
     void Fortune::attachCircleEvent(BeachArc* arc)
     {
     	
@@ -948,10 +1509,10 @@ namespace cinekine
         if (leftArc->site == rightArc->site)
             return;
 
-        const Site& leftSite = _sites[leftArc->site];
+        const Vertex leftSite = _graph.sitePosition(leftArc->site);
         
-        const Site& centerSite = _sites[arc->site];
-        const Site& rightSite = _sites[rightArc->site];
+        const Vertex centerSite = _graph.sitePosition(arc->site);
+        const Vertex rightSite = _graph.sitePosition(rightArc->site);
 
         // Find the circumscribed circle for the three sites associated
       // with the beachsection triplet.
@@ -963,10 +1524,35 @@ namespace cinekine
       // The bottom-most part of the circumcircle is our Fortune 'circle
       // event', and its center is a vertex potentially part of the final
       // Voronoi diagram.
-        float bx = centerSite.x, by = centerSite.y;
+        if (_robustness == Robustness::Adaptive)
+        {
+            // exact orientation of l->c->r; collinear or clockwise
+            // triplets never converge
+            if (predicates::orient2d(leftSite.x, leftSite.y,
+                                     rightSite.x, rightSite.y,
+                                     centerSite.x, centerSite.y) >= 0.0)
+                return;
+
+            double bx = centerSite.x, by = centerSite.y;
+            double ax = leftSite.x - bx, ay = leftSite.y - by;
+            double cx = rightSite.x - bx, cy = rightSite.y - by;
+            double d = 2*(ax*cy - ay*cx);
+            double ha = ax*ax + ay*ay;
+            double hc = cx*cx + cy*cy;
+            double x = (cy*ha - ay*hc)/d;
+            double y = (ax*hc - cx*ha)/d;
+
+            insertCircleEvent(arc, x+bx, y+by, y+by+std::sqrt(x*x+y*y));
+            return;
+        }
+
+        //  in double: nearly collinear sites (the first few of a sweep,
+        //  along the bottom of the bounds) have a far off centre, and in
+        //  float the event's y, centre plus radius, loses every digit
+        double bx = centerSite.x, by = centerSite.y;
         
-        float ax = leftSite.x - bx, ay = leftSite.y - by;
-        float cx = rightSite.x - bx, cy = rightSite.y - by;
+        double ax = leftSite.x - bx, ay = leftSite.y - by;
+        double cx = rightSite.x - bx, cy = rightSite.y - by;
 
         // If points l->c->r are clockwise, then center beach section does not
         // collapse, hence it can't end up as a vertex (we reuse 'd' here, which
@@ -974,26 +1560,32 @@ namespace cinekine
         // http://en.wikipedia.org/wiki/Curve_orientation#Orientation_of_a_simple_polygon
         // rhill 2011-05-21: Nasty finite precision error which caused 
       // circumcircle() to return infinites: 1e-12 seems to fix the problem.
-        float d = 2*(ax*cy - ay*cx);
+        double d = 2*(ax*cy - ay*cx);
         
         if (d >= -2e-9)
             return;
         
 
-        float ha = ax*ax + ay*ay;
-        float hc = cx*cx + cy*cy;
+        double ha = ax*ax + ay*ay;
+        double hc = cx*cx + cy*cy;
         
-        float x = (cy*ha - ay*hc)/d;
-        float y = (ax*hc - cx*ha)/d;
+        double x = (cy*ha - ay*hc)/d;
+        double y = (ax*hc - cx*ha)/d;
         
-        float ycenter = y + by;
+        double ycenter = y + by;
+
+        insertCircleEvent(arc, x+bx, ycenter, ycenter + std::sqrt(x*x+y*y));
+    }
 
+    void Fortune::insertCircleEvent(BeachArc* arc, double x, double yCenter,
+                                    double y)
+    {
         CircleEvent* circleEvent = allocCircleEvent(arc);
         circleEvent->site = arc->site;
         
-        circleEvent->x = x+bx;
-        circleEvent->y = ycenter + std::sqrt(x*x+y*y);
-        circleEvent->yCenter = ycenter;
+        circleEvent->x = x;
+        circleEvent->y = y;
+        circleEvent->yCenter = yCenter;
         
         arc->circleEvent = circleEvent;
 
@@ -1048,7 +1640,6 @@ namespace cinekine
     {
     	
         CircleEvent* circleEvent = arc->circleEvent;
-        d
         if (circleEvent)
         {
             if (!circleEvent->previous())
@@ -1063,14 +1654,94 @@ namespace cinekine
                 
             }
             arc->circleEvent = nullptr;
-            d
         }
     }
 
+    //  Finds the arcs surrounding a new arc at x by walking the beachline
+    //  from _finger, classifying each arc the way the tree descent in
+    //  addBeachSection does.  Only one break point is evaluated per step,
+    //  the other being the one just passed.  Gives up (returning false)
+    //  after about as many steps as the descent would take.  Failures
+    //  back off exponentially, so incoherent input pays next to nothing
+    //  for trying.
+    bool Fortune::findArcsFromFinger(float x, float directrix,
+                                     BeachArc*& leftArc, BeachArc*& rightArc)
+    {
+        if (_fingerSkip)
+        {
+            --_fingerSkip;
+            return false;
+        }
+        if (!walkFromFinger(x, directrix, leftArc, rightArc))
+        {
+            _fingerBackoff = std::min(2*_fingerBackoff + 1, 64);
+            _fingerSkip = _fingerBackoff;
+            return false;
+        }
+        _fingerBackoff = 0;
+        return true;
+    }
+
+    bool Fortune::walkFromFinger(float x, float directrix,
+                                 BeachArc*& leftArc, BeachArc*& rightArc)
+    {
+        int budget = 1;
+        for (int count = _beachArcCnt; count > 1; count >>= 1)
+            ++budget;
+
+        BeachArc* node = _finger;
+        int sxl = leftBreakPointSide(node, x, directrix);
+        int sxr = -1;
+        if (sxl > 0)
+        {
+            do
+            {
+                node = node->previous();
+                if (!node || --budget < 0)
+                    return false;
+                sxl = leftBreakPointSide(node, x, directrix);
+            }
+            while (sxl > 0);
+        }
+        else
+        {
+            sxr = rightBreakPointSide(node, x, directrix);
+            while (sxr > 0)
+            {
+                if (!node->next())
+                {
+                    leftArc = node;
+                    return true;
+                }
+                if (--budget < 0)
+                    return false;
+                node = node->next();
+                sxl = -1;
+                sxr = rightBreakPointSide(node, x, directrix);
+            }
+        }
+
+        if (sxl == 0)
+        {
+            leftArc = node->previous();
+            rightArc = node;
+        }
+        else if (sxr == 0)
+        {
+            leftArc = node;
+            rightArc = node->next();
+        }
+        else
+        {
+            leftArc = rightArc = node;
+        }
+        return true;
+    }
+
     void Fortune::addBeachSection(int siteIndex)
     {
     	
-        const Site& site = _sites[siteIndex];
+        const Vertex site = _graph.sitePosition(siteIndex);
         float x = site.x, directrix = site.y;
         
 
@@ -1080,14 +1751,16 @@ namespace cinekine
         BeachArc* rightArc = nullptr;
         
         BeachArc* node = _beachline.root();
+        if (_finger && findArcsFromFinger(x, directrix, leftArc, rightArc))
+            node = nullptr;
 
         while (node)
         {
         	
-            float dxl = leftBreakPoint(node, directrix) - x;
+            int sxl = leftBreakPointSide(node, x, directrix);
             // x lessThanWithEpsilon xl => falls somewhere before the left edge
             // of the beachsection
-            if (dxl > min_e)     // float episilon
+            if (sxl > 0)
             {
                 node = node->left();
                 
@@ -1095,10 +1768,10 @@ namespace cinekine
             else
             {
             	
-                float dxr = x - rightBreakPoint(node, directrix);
+                int sxr = rightBreakPointSide(node, x, directrix);
                 // x greaterThanWithEpsilon xr => falls somewhere after the
                 // right edge of the beachsection   
-                if (dxr > min_e)
+                if (sxr > 0)
                 {
                 	
                     if (!node->right())
@@ -1115,7 +1788,7 @@ namespace cinekine
                     // x equalWithEpsilon xl => falls exactly on the left edge
                     // of the beachsection
                     
-                    if (dxl > -min_e)
+                    if (sxl == 0)
                     {
                     	
                         leftArc = node->previous();
@@ -1124,7 +1797,7 @@ namespace cinekine
                     }
                     // x equalWithEpsilon xr => falls exactly on the right edge
                     // of the beachsection
-                    else if (dxr > -min_e)
+                    else if (sxr == 0)
                     {
                     	
                         leftArc = node;
@@ -1148,6 +1821,9 @@ namespace cinekine
         
 
         _beachline.insert(leftArc, newArc);
+        ++_beachArcCnt;
+        if (_beachlineSearch == BeachlineSearch::Finger)
+            _finger = newArc;
 
         // [null,null]
     // least likely case: new beach section is the first beach section on the
@@ -1176,6 +1852,7 @@ namespace cinekine
             rightArc = allocArc(leftArc->site);
             
             _beachline.insert(newArc, rightArc);
+            ++_beachArcCnt;
 
             // since we have a new transition between two beach sections,
             // a new edge is born
@@ -1224,11 +1901,11 @@ namespace cinekine
             // http://mathforum.org/library/drmath/view/55002.html
             // Except that I bring the origin at A to simplify
             // calculation
-            const Site& leftSite = _sites[leftArc->site];
+            const Vertex leftSite = _graph.sitePosition(leftArc->site);
             float ax = leftSite.x, ay = leftSite.y;
             
             float bx = site.x - ax, by = site.y - ay;
-            const Site& rightSite = _sites[rightArc->site];
+            const Vertex rightSite = _graph.sitePosition(rightArc->site);
             float cx = rightSite.x - ax, cy = rightSite.y - ay;
             
             float d = 2*(bx*cy-by*cx);
@@ -1269,13 +1946,21 @@ namespace cinekine
         
         BeachArc* next = arc->next();
 
+        //  sites defining the collapsing circle
+        const Vertex circleSites[3] = {
+            _graph.sitePosition(previous->site),
+            _graph.sitePosition(arc->site),
+            _graph.sitePosition(next->site)
+        };
+
         //  ssinha - keep track of what arcs we've staged for deletion
         //  the algorithm needs to reference these arcs after detaching
+        //  arcs to the left are gathered right to left and reversed once
+        //  collected, rather than inserted one by one at the front
         std::vector<BeachArc*> detachedSections;
         
 
         // remove collapsed arc from beachline
-        detachedSections.push_back(arc);
         ++arc->refcnt;
         detachBeachSection(arc);
         
@@ -1290,13 +1975,12 @@ namespace cinekine
         // unconstrained on their left/right side.
         // 
         BeachArc* leftArc = previous;
-        while (leftArc->circleEvent &&
-               std::abs(x-leftArc->circleEvent->x) < min_e &&
-               std::abs(y-leftArc->circleEvent->yCenter) < min_e)
+        while (sharesCircleEvent(vertex, leftArc, leftArc->previous(),
+                                 circleSites))
         {
         	
             previous = leftArc->previous();
-            detachedSections.insert(detachedSections.begin(), leftArc);
+            detachedSections.push_back(leftArc);
             
             ++leftArc->refcnt;
             detachBeachSection(leftArc);
@@ -1308,14 +1992,15 @@ namespace cinekine
         // immediately to the left of the left-most collapsed beach section, for
         // convenience, since we need to refer to it later as this beach section
         // is the 'left' site of an edge for which a start point is set.
-        detachedSections.insert(detachedSections.begin(), leftArc);
+        detachedSections.push_back(leftArc);
+        std::reverse(detachedSections.begin(), detachedSections.end());
+        detachedSections.push_back(arc);
         detachCircleEvent(leftArc);
         
 
         BeachArc* rightArc = next;
-        while (rightArc->circleEvent &&
-               std::abs(x-rightArc->circleEvent->x) < min_e &&
-               std::abs(y-rightArc->circleEvent->yCenter) < min_e)
+        while (sharesCircleEvent(vertex, rightArc, rightArc->next(),
+                                 circleSites))
         {
         	
             next = rightArc->next();
@@ -1357,14 +2042,11 @@ namespace cinekine
         leftArc = detachedSections[0];
         rightArc = detachedSections[numArcs-1];
         
-        detachedSections.erase(detachedSections.begin());
-        detachedSections.pop_back();
-        
-        //  clear detached sections
-        for (auto section: detachedSections)
+        //  clear detached sections (all but the surviving end arcs)
+        for (iArc = 1; iArc+1 < numArcs; ++iArc)
         {
         	
-            releaseArc(section);
+            releaseArc(detachedSections[iArc]);
         }
         detachedSections.clear();
         
@@ -1382,36 +2064,77 @@ namespace cinekine
     {
         detachCircleEvent(arc);
         
+        if (arc == _finger)
+            _finger = nullptr;
         _beachline.remove(arc);
+        --_beachArcCnt;
+        //  a site never regains arcs once it has none left, so its edges
+        //  (and cell) are complete
+        if (!_siteArcs.empty() && !--_siteArcs[arc->site])
+            _finishedSites.push_back(arc->site);
         releaseArc(arc);
     }
 
     ///////////////////////////////////////////////////////////////////////////
     Graph::Graph() :
-    	_cells(),
         _sites(),
+        _xBound(0.0f),
         _edges(),
-        _xBound(0.0f), _yBound(0)
+    	_cells(),
+        _yBound(0),
+        _nearestSiteCells(true)
     {
+        bindSites();
     }
 
-    Graph::Graph(float xBound, float yBound, Sites&& sites) :
+    Graph::Graph(float xBound, float yBound, Sites&& sites,
+                 const BuildOptions& options) :
         _sites(std::move(sites)),
-        _cells(),
+        _xBound(xBound),
         _edges(),
-        _xBound(xBound), _yBound(yBound)
+        _cells(),
+        _yBound(yBound),
+        _options(options),
+        _nearestSiteCells(true)
     {
+        bindSites();
+    }
 
+    Graph::Graph(float xBound, float yBound, const SiteView& sites,
+                 const BuildOptions& options) :
+        _sites(),
+        _xBound(xBound),
+        _edges(),
+        _cells(),
+        _yBound(yBound),
+        _options(options),
+        _nearestSiteCells(true),
+        _siteView(sites),
+        _viewCells(sites.count, -1)
+    {
+        bindSites();
     }
 
     Graph::Graph(Graph&& other) :
-    	_cells(std::move(other._cells)),
         _sites(std::move(other._sites)),
-        _edges(std::move(other._edges)),       
-        _xBound(other._xBound), _yBound(other._yBound)
+        _xBound(other._xBound),
+        _edges(std::move(other._edges)),
+    	_cells(std::move(other._cells)),
+        _yBound(other._yBound),
+        _options(other._options),
+        _cellMetrics(std::move(other._cellMetrics)),
+        _topology(std::move(other._topology)),
+        _siteSources(std::move(other._siteSources)),
+        _nearestSiteCells(other._nearestSiteCells),
+        _freeEdges(std::move(other._freeEdges)),
+        _siteView(other._siteView),
+        _viewCells(std::move(other._viewCells))
     {
         other._yBound = 0.0f;
         other._xBound = 0.0f;
+        other._siteView = SiteView();
+        other.bindSites();
+        bindSites();
     }
 
     Graph& Graph::operator=(Graph&& other)
@@ -1419,20 +2142,71 @@ namespace cinekine
         _sites = std::move(other._sites);
         _edges = std::move(other._edges);
         _cells = std::move(other._cells);
+        _cellMetrics = std::move(other._cellMetrics);
+        _topology = std::move(other._topology);
+        _siteSources = std::move(other._siteSources);
+        _nearestSiteCells = other._nearestSiteCells;
+        _freeEdges = std::move(other._freeEdges);
+        _siteView = other._siteView;
+        _viewCells = std::move(other._viewCells);
+        _options = other._options;
         _yBound = other._yBound;
         _xBound = other._xBound;        
         other._xBound = 0.0f;
         other._yBound = 0.0f;
+        other._siteView = SiteView();
+        other.bindSites();
+        bindSites();
         return *this;
     }
 
+    //  points the strided site accessors at the viewed coordinates (and
+    //  _viewCells) when the graph was built from a SiteView, at _sites
+    //  otherwise
+    void Graph::bindSites()
+    {
+        if (_siteView.x)
+        {
+            _siteX = (const char*)_siteView.x;
+            _siteY = (const char*)_siteView.y;
+            _siteStride = _siteView.stride;
+            _siteCells = (char*)_viewCells.data();
+            _siteCellStride = sizeof(int);
+            _siteCount = _siteView.count;
+            return;
+        }
+
+        Site* sites = _sites.data();
+        _siteX = sites ? (const char*)&sites->x : nullptr;
+        _siteY = sites ? (const char*)&sites->y : nullptr;
+        _siteStride = sizeof(Site);
+        _siteCells = sites ? (char*)&sites->cell : nullptr;
+        _siteCellStride = sizeof(Site);
+        _siteCount = _sites.size();
+    }
+
+    //  adds an edge between left and right to edges, returning its index
+    //  within it; the graph's own edges reuse a released slot if there is
+    //  one (see streamCell)
+    int Graph::newEdge(Edges& edges, int left, int right)
+    {
+        if (&edges == &_edges && !_freeEdges.empty())
+        {
+            int edge = _freeEdges.back();
+            _freeEdges.pop_back();
+            edges[edge] = Edge(left, right);
+            return edge;
+        }
+        edges.emplace_back(left, right);
+        return (int)edges.size()-1;
+    }
+
     int Graph::createEdge(int left, int right,
                           const Vertex& va,
                           const Vertex& vb)
     {
     	
-        _edges.emplace_back(left, right);
-        int edge = (int)_edges.size()-1;
+        int edge = newEdge(_edges, left, right);
 
         if (va)
         {
@@ -1445,12 +2219,10 @@ namespace cinekine
             
         }
 
-        const Site& l = _sites[left];
-        const Site& r = _sites[right];
-        
-
-        _cells[l.cell].halfEdges.push_back(createHalfEdge(edge,left,right));
-        _cells[r.cell].halfEdges.push_back(createHalfEdge(edge,right,left));
+        _cells[siteCell(left)].halfEdges.push_back(
+            createHalfEdge(edge,left,right));
+        _cells[siteCell(right)].halfEdges.push_back(
+            createHalfEdge(edge,right,left));
         
 
         return edge;
@@ -1461,10 +2233,17 @@ namespace cinekine
     int Graph::createBorderEdge(int site, const Vertex& va, const Vertex& vb)
     {
     	
-        _edges.emplace_back(site, -1);
-        int edgeIdx = (int)(_edges.size()-1);
+        return createBorderEdge(_edges, site, va, vb);
+    }
+
+    //  creates a border edge in the supplied container, returning its index
+    //  within it
+    int Graph::createBorderEdge(Edges& edges, int site,
+                                const Vertex& va, const Vertex& vb)
+    {
+        int edgeIdx = newEdge(edges, site, -1);
         
-        Edge& edge = _edges[edgeIdx];
+        Edge& edge = edges[edgeIdx];
         edge.p0 = va;
         
         edge.p1 = vb;
@@ -1472,6 +2251,20 @@ namespace cinekine
         return edgeIdx;
     }
 
+    //  creates a border edge from va to vb and the site's half edge along it
+    //  (see createHalfEdge), referring to the edge as edgeBase plus its index
+    //  in edges
+    HalfEdge Graph::createBorderHalfEdge(Edges& edges, int edgeBase, int site,
+                                         const Vertex& va, const Vertex& vb)
+    {
+        HalfEdge halfedge;
+        halfedge.edge = edgeBase + createBorderEdge(edges, site, va, vb);
+        halfedge.site = site;
+        halfedge.angle = halfEdgeAngle(vb.x-va.x, va.y-vb.y);
+
+        return halfedge;
+    }
+
     HalfEdge Graph::createHalfEdge(int edge, int lSite, int rSite)
     {
     	
@@ -1480,13 +2273,13 @@ namespace cinekine
         
         halfedge.site = lSite;
 
-        const Site& lSiteRef = _sites[lSite];
+        const Vertex lSiteRef = sitePosition(lSite);
         if (rSite >= 0)
         {
         	
-            const Site& rSiteRef = _sites[rSite];
-            halfedge.angle = std::atan2(rSiteRef.y-lSiteRef.y,
-                                        rSiteRef.x-lSiteRef.x);
+            const Vertex rSiteRef = sitePosition(rSite);
+            halfedge.angle = halfEdgeAngle(rSiteRef.y-lSiteRef.y,
+                                           rSiteRef.x-lSiteRef.x);
             
         }
         else
@@ -1495,14 +2288,14 @@ namespace cinekine
             
             if (edgeRef.leftSite != lSite)
             {
-            	halfedge.angle = std::atan2(edgeRef.p0.x-edgeRef.p1.x,
-                                            edgeRef.p1.y-edgeRef.p0.y);                
+            	halfedge.angle = halfEdgeAngle(edgeRef.p0.x-edgeRef.p1.x,
+                                               edgeRef.p1.y-edgeRef.p0.y);                
                 
             }
             else
             {
-                halfedge.angle = std::atan2(edgeRef.p1.x-edgeRef.p0.x,
-                                            edgeRef.p0.y-edgeRef.p1.y);
+                halfedge.angle = halfEdgeAngle(edgeRef.p1.x-edgeRef.p0.x,
+                                               edgeRef.p0.y-edgeRef.p1.y);
                 
             }
         }
@@ -1510,8 +2303,16 @@ namespace cinekine
 
         return halfedge;
     }
+
+    float Graph::halfEdgeAngle(float dy, float dx) const
+    {
+        if (_options.halfEdgeOrder == HalfEdgeOrder::PseudoAngle)
+            return pseudoAngle(dy, dx);
+
+        return std::atan2(dy, dx);
+    }
     
-    bool Graph::connectEdge(int edgeIdx)
+    bool Graph::connectEdge(int edgeIdx, bool& bordered)
     {
     	
         const float xBound = _xBound;
@@ -1530,8 +2331,8 @@ namespace cinekine
                     xl = 0.0f,
                     xr = xBound;
         
-        const Site& lSite = _sites[edge.leftSite];
-        const Site& rSite = _sites[edge.rightSite];
+        const Vertex lSite = sitePosition(edge.leftSite);
+        const Vertex rSite = sitePosition(edge.rightSite);
         
         const float rx = rSite.x,
                     ry = rSite.y,
@@ -1543,9 +2344,7 @@ namespace cinekine
         // if we reach here, this means cells which use this edge will need
         // to be closed, whether because the edge was removed, or because it
         // was connected to the bounding box.
-        _cells[lSite.cell].closeMe = true;
-        
-        _cells[rSite.cell].closeMe = true;
+        bordered = true;
 
         Vertex p1;
         Vertex p0 = edge.p0;
@@ -1673,7 +2472,7 @@ namespace cinekine
     //   http://www.skytopia.com/project/articles/compsci/clipping.html
     // Thanks!
     // A bit modified to minimize code paths
-    bool Graph::clipEdge(int edgeIdx)
+    bool Graph::clipEdge(int edgeIdx, bool& bordered)
     {
     	
         const float xBound = _xBound;
@@ -1692,6 +2491,13 @@ namespace cinekine
               t0 = 0,
               t1 = 1;
 
+        //  the side each end was clipped against, so the clipped end can
+        //  be placed on it exactly; far away ends lose too much precision
+        //  in ax+t*dx to land within min_e of the side
+        enum Side { None, Left, Right, Top, Bottom };
+        Side side0 = None,
+             side1 = None;
+
         // left
         float q = ax;
                
@@ -1703,14 +2509,14 @@ namespace cinekine
         {
         	
             if (r < t0) return false;
-            if (r < t1) t1 = r;
+            if (r < t1) { t1 = r; side1 = Left; }
             
         }
         else if (dx > 0.0f)
         {
         	
             if (r > t1) return false;
-            if (r > t0) t0 = r;
+            if (r > t0) { t0 = r; side0 = Left; }
             
         }
         // right
@@ -1723,14 +2529,14 @@ namespace cinekine
         {
         	
             if (r > t1) return false;
-            if (r > t0) t0 = r;
+            if (r > t0) { t0 = r; side0 = Right; }
             
         }
         else if (dx > 0.0f)
         {
         	
             if (r < t0) return false;
-            if (r < t1) t1 = r;
+            if (r < t1) { t1 = r; side1 = Right; }
             
         }
         // top
@@ -1743,14 +2549,14 @@ namespace cinekine
         {
         	
             if (r < t0) return false;
-            if (r < t1) t1 = r;
+            if (r < t1) { t1 = r; side1 = Top; }
             
         }
         else if (dy > 0.0f)
         {
         	
             if (r > t1) return false;
-            if (r > t0) t0 = r;
+            if (r > t0) { t0 = r; side0 = Top; }
             
         }
         // bottom
@@ -1764,19 +2570,31 @@ namespace cinekine
         {
         	
             if (r > t1) return false;
-            if (r > t0) t0 = r;
+            if (r > t0) { t0 = r; side0 = Bottom; }
             
         }
         else if (dy > 0.0f)
         {
         	
             if (r < t0) return false;
-            if (r < t1) t1 = r;
+            if (r < t1) { t1 = r; side1 = Bottom; }
             
         }
 
         // if we reach this point, Voronoi edge is within bbox
 
+        auto pinToSide = [xBound, yBound](Vertex& v, Side side)
+        {
+            switch (side)
+            {
+            case Left:      v.x = 0.0f;     break;
+            case Right:     v.x = xBound;   break;
+            case Top:       v.y = 0.0f;     break;
+            case Bottom:    v.y = yBound;   break;
+            default:                        break;
+            }
+        };
+
         // if t0 > 0, p0 needs to change
         // rhill 2011-06-03: we need to create a new vertex rather
         // than modifying the existing one, since the existing
@@ -1785,6 +2603,7 @@ namespace cinekine
         {
         	
             edge.p0 = Vertex(ax+t0*dx, ay+t0*dy);
+            pinToSide(edge.p0, side0);
             if (edge.p0.x < min_e)
                 edge.p0.x = 0.f;
             
@@ -1801,6 +2620,7 @@ namespace cinekine
         {
         	
             edge.p1 = Vertex(ax+t1*dx, ay+t1*dy);
+            pinToSide(edge.p1, side1);
             if (edge.p1.x < min_e)
                 edge.p1.x = 0.f;
             
@@ -1814,8 +2634,7 @@ namespace cinekine
         if (t0 > 0.0f || t1 < 1.0f)
         {
         	
-            _cells[_sites[edge.leftSite].cell].closeMe = true;
-            _cells[_sites[edge.rightSite].cell].closeMe = true;
+            bordered = true;
             
         }
 
@@ -1832,57 +2651,120 @@ namespace cinekine
     {
     	
         int numEdges = (int)_edges.size();
+        unsigned threadCount = _options.finalizeThreads;
 
-        for (int i = 0; i < numEdges; ++i)
+        if (threadCount <= 1)
         {
-        	
-            Edge& edge = _edges[i];
-
-            // edge is cleared (not moved -- ssinha) if:
-            //   it is wholly outside the bounding box
-            //   it is looking more like a point than a line
-            //   ssinha - we rely on keeping the edges container
-            //   constant (though the edges can change, the indexing
-            //   can't - perhaps use a hash/map instead of a vector
-            //   to mitigate our reliance on having a continguous and
-            //   unchanging edge vector)
-            if (!connectEdge(i) ||
-                !clipEdge(i) ||
-                (std::abs(edge.p0.x-edge.p1.x) < min_e &&
-                 std::abs(edge.p0.y-edge.p1.y) < min_e))
+            for (int i = 0; i < numEdges; ++i)
             {
-            	
-                //  ssinha - the javascript impl removes the edge from
-                //  the edges container, but of course the edge may
-                //  still be referenced by a halfedge/cell, keeping it
-                //  alive (and erased when finalizing the cell)  In this
-                //  version, we keep the edge since its part of a
-                //  pool/vector (see above as to why)
-                edge.p0 = Vertex::undefined;
-                edge.p1 = Vertex::undefined;
-                
+                if (finalizeEdge(i))
+                    markCellsToClose(i);
             }
+            return;
+        }
+
+        //  edges are independent of each other; cells are only flagged for
+        //  closing once all threads are done
+        std::vector<char> bordered(numEdges, 0);
+        int blockSize = (numEdges + (int)threadCount - 1) / (int)threadCount;
+
+        parallelFor(threadCount, [&](unsigned thread)
+        {
+            int begin = std::min(numEdges, (int)thread * blockSize);
+            int end = std::min(numEdges, begin + blockSize);
+            for (int i = begin; i < end; ++i)
+                bordered[i] = finalizeEdge(i);
+        });
+
+        for (int i = 0; i < numEdges; ++i)
+        {
+            if (bordered[i])
+                markCellsToClose(i);
+        }
+    }
+
+    //  Connects a dangling edge to the bounding box and clips it, returning
+    //  whether the cells on either side of it need closing.
+    bool Graph::finalizeEdge(int edgeIdx)
+    {
+        Edge& edge = _edges[edgeIdx];
+        bool bordered = false;
+
+        // edge is cleared (not moved -- ssinha) if:
+        //   it is wholly outside the bounding box
+        //   it is looking more like a point than a line
+        //   ssinha - we rely on keeping the edges container
+        //   constant (though the edges can change, the indexing
+        //   can't - perhaps use a hash/map instead of a vector
+        //   to mitigate our reliance on having a continguous and
+        //   unchanging edge vector)
+        if (!connectEdge(edgeIdx, bordered) ||
+            !clipEdge(edgeIdx, bordered) ||
+            isPointLike(edge))
+        {
+        	
+            //  ssinha - the javascript impl removes the edge from
+            //  the edges container, but of course the edge may
+            //  still be referenced by a halfedge/cell, keeping it
+            //  alive (and erased when finalizing the cell)  In this
+            //  version, we keep the edge since its part of a
+            //  pool/vector (see above as to why)
+            edge.p0 = Vertex::undefined;
+            edge.p1 = Vertex::undefined;
+            
         }
+
+        return bordered;
+    }
+
+    //  Under Robustness::Adaptive only a true point is dropped: the sweep
+    //  keeps near-cocircular vertices apart, and dropping an edge shorter
+    //  than min_e between them would leave a gap in both of its cells.
+    bool Graph::isPointLike(const Edge& edge) const
+    {
+        if (_options.robustness == Robustness::Adaptive)
+            return edge.p0.x == edge.p1.x && edge.p0.y == edge.p1.y;
+        return std::abs(edge.p0.x-edge.p1.x) < min_e &&
+               std::abs(edge.p0.y-edge.p1.y) < min_e;
+    }
+
+    void Graph::markCellsToClose(int edgeIdx)
+    {
+        const Edge& edge = _edges[edgeIdx];
+        _cells[siteCell(edge.leftSite)].closeMe = true;
+        _cells[siteCell(edge.rightSite)].closeMe = true;
     }
 
-    Vertex Graph::getHalfEdgeStartpoint(const HalfEdge& halfEdge)
+    Vertex Graph::getHalfEdgeStartpoint(const HalfEdge& halfEdge) const
     {
     	
         const Edge& edge = _edges[halfEdge.edge];
         
-        return edge.leftSite == halfEdge.site ? edge.p0 : edge.p1;
+        return edge.leftSite == halfEdge.site ? edge.p0 :
+                                                unwrapVertex(edge.p1, edge);
         
     }
 
-    Vertex Graph::getHalfEdgeEndpoint(const HalfEdge& halfEdge)
+    Vertex Graph::getHalfEdgeEndpoint(const HalfEdge& halfEdge) const
     {
     	
         const Edge& edge = _edges[halfEdge.edge];
         
-        return edge.leftSite == halfEdge.site ? edge.p1 : edge.p0;
+        return edge.leftSite == halfEdge.site ? edge.p1 :
+                                                unwrapVertex(edge.p0, edge);
         
     }
 
+    //  moves a vertex of edge from the left site's frame to the right's
+    Vertex Graph::unwrapVertex(const Vertex& vertex, const Edge& edge) const
+    {
+        if (!edge.wrapX && !edge.wrapY)
+            return vertex;
+
+        return Vertex(vertex.x - edge.wrapX*_xBound,
+                      vertex.y - edge.wrapY*_yBound);
+    }
+
     // Initialize half edges following build
     // 
     bool Graph::prepareHalfEdgesForCell(int32_t cell)
@@ -1894,22 +2776,15 @@ namespace cinekine
 
         HalfEdges& halfEdges = _cells[cell].halfEdges;
 
-        // get rid of unused halfedges
-        for (auto it = halfEdges.begin(); it < halfEdges.end();)
-        {
-        	
-            Edge& edge = _edges[(*it).edge];
-            if (!edge.p1 || !edge.p0)
-            {
-                it = halfEdges.erase(it);
-                
-            }
-            else
-            {
-                ++it;
-                
-            }
-        }
+        // get rid of unused halfedges (compacting in one pass)
+        const Edges& edges = _edges;
+        halfEdges.erase(std::remove_if(halfEdges.begin(), halfEdges.end(),
+                            [&edges](const HalfEdge& halfEdge)
+                            {
+                                const Edge& edge = edges[halfEdge.edge];
+                                return !edge.p1 || !edge.p0;
+                            }),
+                        halfEdges.end());
         //  descending order
         std::sort(halfEdges.begin(), halfEdges.end(),
                   [](const HalfEdge& a, const HalfEdge& b)
@@ -1926,232 +2801,568 @@ namespace cinekine
     // of halfedges ordered counterclockwise.
     void Graph::closeCells()
     {
-    	
+        if (_options.finalizeThreads > 1)
+        {
+            closeCellsParallel(_options.finalizeThreads);
+        }
+        else
+        {
+            size_t iCell = _cells.size();
+
+            if (_options.cellMetrics)
+                _cellMetrics.resize(iCell);
+
+            while (iCell--)
+            {
+                closeCell((int)iCell, _edges, 0);
+
+                if (_options.cellMetrics)
+                    measureCell((int)iCell);
+            }
+        }
+
+        if (_options.topology)
+            linkHalfEdges();
+    }
+
+    // Prune and order the half edges of a cell, then add the border edges
+    // required to close it.  Border edges are appended to borderEdges and
+    // referenced from half edges as edgeBase plus their index there.
+    // Returns whether border edges may have been added.
+    bool Graph::closeCell(int32_t iCell, Edges& borderEdges, int edgeBase)
+    {
         const float yt = 0.0f,
                     yb = _yBound,
                     xl = 0.0f,
                     xr = _xBound;
-        
 
-        size_t iCell = _cells.size();
+        Cell& cell = _cells[iCell];
 
-        while (iCell--)
+        // prune, order halfedges counterclockwise, then add missing ones
+        // required to close cells
+        if (!prepareHalfEdgesForCell(iCell) || !cell.closeMe)
+            return false;
+        
+        // find first 'unclosed' point.
+        // an 'unclosed' point will be the end point of a halfedge which
+        // does not match the start point of the following halfedge
+        //
+        // the closed list is built alongside rather than by inserting
+        // in place, which is quadratic for cells with many edges
+        HalfEdges& halfEdges = cell.halfEdges;
+        size_t nHalfEdges = halfEdges.size();
+        HalfEdges closed;
+        closed.reserve(nHalfEdges + 4);
+
+        // special case: only one site, in which case, the viewport is the
+        // cell
+        // ... (ssinha todo - is this needed?)
+
+        // all other cases
+        size_t iLeft = 0;
+
+        //printf("Cell: (%d)\n", cell.site);
+        while (iLeft < nHalfEdges)
         {
+        	closed.push_back(halfEdges[iLeft]);
         	
-            Cell& cell = _cells[iCell];
-
-            // prune, order halfedges counterclockwise, then add missing ones
-            // required to close cells
-            if (!prepareHalfEdgesForCell((int)iCell))
-                continue;
-            
-            if (!cell.closeMe)
-                continue;
-            
-
-            // find first 'unclosed' point.
-            // an 'unclosed' point will be the end point of a halfedge which
-            // does not match the start point of the following halfedge
-            HalfEdges& halfEdges = cell.halfEdges;
-            size_t nHalfEdges = halfEdges.size();
+            Vertex va = getHalfEdgeEndpoint(halfEdges[iLeft]);
+            size_t iNextLeft = (iLeft+1) % nHalfEdges;
             
-
-            // special case: only one site, in which case, the viewport is the
-            // cell
-            // ... (ssinha todo - is this needed?)
-
-            // all other cases
-            size_t iLeft = 0;
-
-            //printf("Cell: (%d)\n", cell.site);
-            while (iLeft < nHalfEdges)
+            Vertex vz = getHalfEdgeStartpoint(halfEdges[iNextLeft]);
+            // if end point is not equal to start point, we need to add the
+            //  missing halfedge(s) up to vz
+            if (std::abs(va.x - vz.x)>=min_e || std::abs(va.y - vz.y)>=min_e)
             {
-            	
-                Vertex va = getHalfEdgeEndpoint(halfEdges[iLeft]);
-                size_t iNextLeft = (iLeft+1) % nHalfEdges;
+                // "Holes" in the halfedges are not necessarily always
+                // adjacent.
+                bool lastBorderSegment = false;
                 
-                Vertex vz = getHalfEdgeStartpoint(halfEdges[iNextLeft]);
-                // if end point is not equal to start point, we need to add the
-                //  missing halfedge(s) up to vz
-                if (std::abs(va.x - vz.x)>=min_e || std::abs(va.y - vz.y)>=min_e)
-                {
-                    // "Holes" in the halfedges are not necessarily always
-                    // adjacent.
-                    bool lastBorderSegment = false;
+                Vertex vb;
+                // walk downward along left side
+                if (std::abs(va.x-xl)<min_e && (yb-va.y)>min_e)
+                {
+                	
+                    //printf("new border edge: Left, vz=(%.6f,%.6f)\n", vz.x, vz.y);
+                    lastBorderSegment = std::abs(vz.x-xl) < min_e;
+                    vb = Vertex(xl, lastBorderSegment ? vz.y : yb);
+                    closed.push_back(createBorderHalfEdge(borderEdges, edgeBase,
+                                                          cell.site, va, vb));
                     
-                    Vertex vb;
-                    int edgeIdx = -1;
-                    // walk downward along left side
-                    if (std::abs(va.x-xl)<min_e && (yb-va.y)>min_e)
-                    {
-                    	
-                        //printf("new border edge: Left, vz=(%.6f,%.6f)\n", vz.x, vz.y);
-                        lastBorderSegment = std::abs(vz.x-xl) < min_e;
-                        vb = Vertex(xl, lastBorderSegment ? vz.y : yb);
-                        edgeIdx = createBorderEdge(cell.site, va, vb);
-                        
-                        ++iLeft;
-                        halfEdges.insert(halfEdges.begin()+iLeft,
-                                         createHalfEdge(edgeIdx,cell.site, -1));
-                        ++nHalfEdges;
-                        
-                        if (!lastBorderSegment)
-                            va = vb;
-                        
-                    }
-                    // walk rightward along bottom side
-                    if (!lastBorderSegment && std::abs(va.y-yb)<min_e && (xr-va.x)>min_e)
-                    {
-                        //printf("new border edge: Bottom, vz=(%.6f,%.6f)\n", vz.x, vz.y);
-                        lastBorderSegment = std::abs(vz.y-yb) < min_e;
-                        
-                        vb = Vertex(lastBorderSegment ? vz.x : xr, yb);
-                        edgeIdx = createBorderEdge(cell.site, va, vb);
-                        ++iLeft;
-                        
-                        halfEdges.insert(halfEdges.begin()+iLeft,
-                                         createHalfEdge(edgeIdx,cell.site, -1));
-                        ++nHalfEdges;
-                        
-                        if (!lastBorderSegment)
-                            va = vb;
-                        
-                    }
-                    // walk upward along right side
-                    if (!lastBorderSegment && std::abs(va.x-xr)<min_e && (va.y-yt)>min_e)
-                    {
-                        //printf("new border edge: Right, vz=(%.6f,%.6f)\n", vz.x, vz.y);
-                        lastBorderSegment = std::abs(vz.x-xr) < min_e;
-                        
-                        vb = Vertex(xr, lastBorderSegment ? vz.y : yt);
-                        edgeIdx = createBorderEdge(cell.site, va, vb);
-                        ++iLeft;
-                        
-                        halfEdges.insert(halfEdges.begin()+iLeft,
-                                         createHalfEdge(edgeIdx,cell.site, -1));
-                        ++nHalfEdges;
-                        
-                        if (!lastBorderSegment)
-                            va = vb;
-                        
-                    }
-                    // walk leftward along top side
-                    if (!lastBorderSegment && std::abs(va.y-yt)<min_e && (va.x-xl)>min_e)
-                    {
-                        //printf("new border edge: Top, vz=(%.6f,%.6f)\n", vz.x, vz.y);
-                        lastBorderSegment = std::abs(vz.y-yt) < min_e;
-                        
-                        vb = Vertex(lastBorderSegment ? vz.x : xl, yt);
-                        edgeIdx = createBorderEdge(cell.site, va, vb);
-                        ++iLeft;
-                        
-                        halfEdges.insert(halfEdges.begin()+iLeft,
-                                         createHalfEdge(edgeIdx,cell.site, -1));
-                        ++nHalfEdges;
-                        
-                        if (!lastBorderSegment)
-                            va = vb;
-                        
-                    }
-
-                    // walk downward along left side
                     if (!lastBorderSegment)
-                    {
-                        //printf("new border edge: Left 2, vz=(%.6f,%.6f)\n", vz.x, vz.y);
-                        lastBorderSegment = std::abs(vz.x-xl) < min_e;
-                        
-                        vb = Vertex(xl, lastBorderSegment ? vz.y : yb);
-                        edgeIdx = createBorderEdge(cell.site, va, vb);
-                        ++iLeft;
-                        
-                        halfEdges.insert(halfEdges.begin()+iLeft,
-                                         createHalfEdge(edgeIdx,cell.site, -1));
-                        ++nHalfEdges;
-                        
-                        if (!lastBorderSegment)
-                            va = vb;
-                        
-                    }
-                    // walk rightward along bottom side
+                        va = vb;
+                    
+                }
+                // walk rightward along bottom side
+                if (!lastBorderSegment && std::abs(va.y-yb)<min_e && (xr-va.x)>min_e)
+                {
+                    //printf("new border edge: Bottom, vz=(%.6f,%.6f)\n", vz.x, vz.y);
+                    lastBorderSegment = std::abs(vz.y-yb) < min_e;
+                    
+                    vb = Vertex(lastBorderSegment ? vz.x : xr, yb);
+                    closed.push_back(createBorderHalfEdge(borderEdges, edgeBase,
+                                                          cell.site, va, vb));
+                    
                     if (!lastBorderSegment)
-                    {
-                        //printf("new border edge: Bottom 2, vz=(%.6f,%.6f)\n", vz.x, vz.y);
-                        lastBorderSegment = std::abs(vz.y-yb) < min_e;
-                        
-                        vb = Vertex(lastBorderSegment ? vz.x : xr, yb);
-                        edgeIdx = createBorderEdge(cell.site, va, vb);
-                        ++iLeft;
-                        
-                        halfEdges.insert(halfEdges.begin()+iLeft,
-                                         createHalfEdge(edgeIdx,cell.site, -1));
-                        ++nHalfEdges;
-                        
-                        if (!lastBorderSegment)
-                            va = vb;
-                        
-                    }
-                    // walk upward along right side
+                        va = vb;
+                    
+                }
+                // walk upward along right side
+                if (!lastBorderSegment && std::abs(va.x-xr)<min_e && (va.y-yt)>min_e)
+                {
+                    //printf("new border edge: Right, vz=(%.6f,%.6f)\n", vz.x, vz.y);
+                    lastBorderSegment = std::abs(vz.x-xr) < min_e;
+                    
+                    vb = Vertex(xr, lastBorderSegment ? vz.y : yt);
+                    closed.push_back(createBorderHalfEdge(borderEdges, edgeBase,
+                                                          cell.site, va, vb));
+                    
+                    if (!lastBorderSegment)
+                        va = vb;
+                    
+                }
+                // walk leftward along top side
+                if (!lastBorderSegment && std::abs(va.y-yt)<min_e && (va.x-xl)>min_e)
+                {
+                    //printf("new border edge: Top, vz=(%.6f,%.6f)\n", vz.x, vz.y);
+                    lastBorderSegment = std::abs(vz.y-yt) < min_e;
+                    
+                    vb = Vertex(lastBorderSegment ? vz.x : xl, yt);
+                    closed.push_back(createBorderHalfEdge(borderEdges, edgeBase,
+                                                          cell.site, va, vb));
+                    
+                    if (!lastBorderSegment)
+                        va = vb;
+                    
+                }
+
+                // walk downward along left side
+                if (!lastBorderSegment)
+                {
+                    //printf("new border edge: Left 2, vz=(%.6f,%.6f)\n", vz.x, vz.y);
+                    lastBorderSegment = std::abs(vz.x-xl) < min_e;
+                    
+                    vb = Vertex(xl, lastBorderSegment ? vz.y : yb);
+                    closed.push_back(createBorderHalfEdge(borderEdges, edgeBase,
+                                                          cell.site, va, vb));
+                    
+                    if (!lastBorderSegment)
+                        va = vb;
+                    
+                }
+                // walk rightward along bottom side
+                if (!lastBorderSegment)
+                {
+                    //printf("new border edge: Bottom 2, vz=(%.6f,%.6f)\n", vz.x, vz.y);
+                    lastBorderSegment = std::abs(vz.y-yb) < min_e;
+                    
+                    vb = Vertex(lastBorderSegment ? vz.x : xr, yb);
+                    closed.push_back(createBorderHalfEdge(borderEdges, edgeBase,
+                                                          cell.site, va, vb));
+                    
                     if (!lastBorderSegment)
+                        va = vb;
+                    
+                }
+                // walk upward along right side
+                if (!lastBorderSegment)
+                {
+                    //printf("new border edge: Right 2, vz=(%.6f,%.6f)\n", vz.x, vz.y);
+                    lastBorderSegment = std::abs(vz.x-xr) < min_e;
+                    
+                    vb = Vertex(xr, lastBorderSegment ? vz.y : yt);
+                    closed.push_back(createBorderHalfEdge(borderEdges, edgeBase,
+                                                          cell.site, va, vb));
+                    
+                }
+            }
+            ++iLeft;
+        }
+        
+        halfEdges.swap(closed);
+        cell.closeMe = false;
+
+        return true;
+    }
+
+    // Parallel closeCells.  Each thread closes a contiguous block of cells
+    // into its own border edge buffer; the buffers are then appended in the
+    // order the serial pass would have produced them (highest cells first),
+    // and the half edges referring to them are rebased.
+    void Graph::closeCellsParallel(unsigned threadCount)
+    {
+        const int cellCount = (int)_cells.size();
+        const int blockSize = (cellCount + (int)threadCount - 1) /
+                              (int)threadCount;
+        // marks half edges whose edge is still local to a thread buffer
+        const int localBase = std::numeric_limits<int>::min();
+
+        if (_options.cellMetrics)
+            _cellMetrics.resize(cellCount);
+
+        std::vector<Edges> borderEdges(threadCount);
+        std::vector<std::vector<int>> closedCells(threadCount);
+
+        parallelFor(threadCount, [&](unsigned thread)
+        {
+            int begin = std::min(cellCount, (int)thread * blockSize);
+            int iCell = std::min(cellCount, begin + blockSize);
+            while (iCell-- > begin)
+            {
+                if (closeCell(iCell, borderEdges[thread], localBase))
+                    closedCells[thread].push_back(iCell);
+            }
+        });
+
+        std::vector<int> edgeBase(threadCount);
+        unsigned thread = threadCount;
+        while (thread--)
+        {
+            edgeBase[thread] = (int)_edges.size();
+            _edges.insert(_edges.end(), borderEdges[thread].begin(),
+                          borderEdges[thread].end());
+        }
+
+        parallelFor(threadCount, [&](unsigned thread)
+        {
+            for (int iCell : closedCells[thread])
+            {
+                for (auto& halfEdge : _cells[iCell].halfEdges)
+                {
+                    //  back to the local index before adding the base;
+                    //  edgeBase - localBase would overflow an int
+                    if (halfEdge.edge < 0)
                     {
-                        //printf("new border edge: Right 2, vz=(%.6f,%.6f)\n", vz.x, vz.y);
-                        lastBorderSegment = std::abs(vz.x-xr) < min_e;
-                        
-                        vb = Vertex(xr, lastBorderSegment ? vz.y : yt);
-                        edgeIdx = createBorderEdge(cell.site, va, vb);
-                        ++iLeft;
-                        
-                        halfEdges.insert(halfEdges.begin()+iLeft,
-                                         createHalfEdge(edgeIdx,cell.site, -1));
-                        ++nHalfEdges;
-                        
+                        halfEdge.edge = (halfEdge.edge - localBase) +
+                                        edgeBase[thread];
                     }
                 }
-                ++iLeft;
             }
-            
-            cell.closeMe = false;
+            if (_options.cellMetrics)
+            {
+                int begin = std::min(cellCount, (int)thread * blockSize);
+                int end = std::min(cellCount, begin + blockSize);
+                for (int iCell = begin; iCell < end; ++iCell)
+                    measureCell(iCell);
+            }
+        });
+    }
+
+    void CellMetrics::resize(size_t count)
+    {
+        area.resize(count);
+        centroidX.resize(count);
+        centroidY.resize(count);
+        perimeter.resize(count);
+        minX.resize(count);
+        minY.resize(count);
+        maxX.resize(count);
+        maxY.resize(count);
+    }
+
+    void CellMetrics::clear()
+    {
+        resize(0);
+    }
+
+    void Topology::clear()
+    {
+        cellHalfEdges.clear();
+        cell.clear();
+        next.clear();
+        prev.clear();
+        twin.clear();
+        origin.clear();
+        vertices.clear();
+        vertexHalfEdge.clear();
+    }
+
+    ///////////////////////////////////////////////////////////////////////////
+    //  Numbers the half edges of the closed cells and links them (see
+    //  Topology.)  Twins are the two half edges referring to one edge.
+    //  The half edges leaving a vertex are chained by h -> next[twin[h]],
+    //  so vertices are found by merging along those links with a union-
+    //  find, parented through origin while it runs.
+    void Graph::linkHalfEdges()
+    {
+        Topology& topology = _topology;
+        topology.clear();
+
+        const int cellCount = (int)_cells.size();
+        topology.cellHalfEdges.resize(cellCount + 1);
+        int count = 0;
+        for (int iCell = 0; iCell < cellCount; ++iCell)
+        {
+            topology.cellHalfEdges[iCell] = count;
+            count += (int)_cells[iCell].halfEdges.size();
+        }
+        topology.cellHalfEdges[cellCount] = count;
+
+        topology.cell.resize(count);
+        topology.next.resize(count);
+        topology.prev.resize(count);
+        topology.twin.assign(count, -1);
+        topology.origin.resize(count);
+
+        std::vector<int> edgeHalfEdge(_edges.size(), -1);
+        for (int iCell = 0; iCell < cellCount; ++iCell)
+        {
+            const HalfEdges& halfEdges = _cells[iCell].halfEdges;
+            const int base = topology.cellHalfEdges[iCell];
+            const int size = (int)halfEdges.size();
+            for (int i = 0; i < size; ++i)
+            {
+                const int h = base + i;
+                topology.cell[h] = iCell;
+                topology.next[h] = base + (i + 1) % size;
+                topology.prev[h] = base + (i + size - 1) % size;
+                topology.origin[h] = h;
+
+                int& other = edgeHalfEdge[halfEdges[i].edge];
+                if (other < 0)
+                {
+                    other = h;
+                }
+                else
+                {
+                    topology.twin[h] = other;
+                    topology.twin[other] = h;
+                }
+            }
+        }
+
+        std::vector<int>& parent = topology.origin;
+        auto find = [&parent](int h)
+        {
+            while (parent[h] != h)
+            {
+                parent[h] = parent[parent[h]];
+                h = parent[h];
+            }
+            return h;
+        };
+        for (int h = 0; h < count; ++h)
+        {
+            const int twin = topology.twin[h];
+            if (twin < h)
+                continue;
+            //  h and next[twin] leave one end of the edge, twin and
+            //  next[h] the other
+            const int a = find(h), b = find(topology.next[twin]);
+            parent[std::max(a, b)] = std::min(a, b);
+            const int c = find(twin), d = find(topology.next[h]);
+            parent[std::max(c, d)] = std::min(c, d);
+        }
+
+        //  roots are their sets' lowest half edge, so are numbered before
+        //  the rest of their set is
+        for (int h = 0; h < count; ++h)
+            parent[h] = find(h);
+        for (int h = 0; h < count; ++h)
+        {
+            const int root = parent[h];
+            if (root == h)
+            {
+                parent[h] = (int)topology.vertices.size();
+                topology.vertices.push_back(
+                    getHalfEdgeStartpoint(halfEdge(h)));
+                topology.vertexHalfEdge.push_back(h);
+            }
+            else
+            {
+                parent[h] = parent[root];
+            }
+        }
+    }
+
+    // Measure a closed cell while its half edges are still hot from
+    // closeCells.  Sums are carried in double, the polygon is walked in
+    // half edge order (area is reported unsigned.)
+    void Graph::measureCell(int32_t cell)
+    {
+        const Cell& cellRef = _cells[cell];
+        const Vertex site = sitePosition(cellRef.site);
+
+        double area2 = 0.0, cx = 0.0, cy = 0.0, perimeter = 0.0;
+        float minX = site.x, minY = site.y, maxX = site.x, maxY = site.y;
+
+        if (!cellRef.halfEdges.empty())
+        {
+            minX = minY = std::numeric_limits<float>::max();
+            maxX = maxY = -std::numeric_limits<float>::max();
+        }
+
+        for (auto& halfEdge : cellRef.halfEdges)
+        {
+            Vertex va = getHalfEdgeStartpoint(halfEdge);
+            Vertex vb = getHalfEdgeEndpoint(halfEdge);
+
+            double cross = (double)va.x*vb.y - (double)vb.x*va.y;
+            area2 += cross;
+            cx += ((double)va.x + vb.x) * cross;
+            cy += ((double)va.y + vb.y) * cross;
+
+            double dx = (double)vb.x - va.x, dy = (double)vb.y - va.y;
+            perimeter += std::sqrt(dx*dx + dy*dy);
+
+            minX = std::min(minX, va.x);
+            maxX = std::max(maxX, va.x);
+            minY = std::min(minY, va.y);
+            maxY = std::max(maxY, va.y);
+        }
+
+        CellMetrics& metrics = _cellMetrics;
+        if (area2 != 0.0)
+        {
+            metrics.centroidX[cell] = (float)(cx / (3.0*area2));
+            metrics.centroidY[cell] = (float)(cy / (3.0*area2));
+        }
+        else
+        {
+            metrics.centroidX[cell] = site.x;
+            metrics.centroidY[cell] = site.y;
         }
+        metrics.area[cell] = (float)std::abs(area2*0.5);
+        metrics.perimeter[cell] = (float)perimeter;
+        metrics.minX[cell] = minX;
+        metrics.minY[cell] = minY;
+        metrics.maxX[cell] = maxX;
+        metrics.maxY[cell] = maxY;
     }
 
     ///////////////////////////////////////////////////////////////////////////
-    //  a method for constructing a voronoi graph
-    //  
-    Graph build(Sites&& sites, float xBound, float yBound)
+    //  Finalizes the edges of a cell no longer on the beachline, closes
+    //  and measures it, hands it to onCell and releases its half edges.
+    //  edgeDone marks the edges already finalized (or created closing a
+    //  cell), which must not be finalized again, and 2 once one of their
+    //  cells has been streamed.  The second cell to be streamed releases
+    //  the edge (its only cell, for a border edge) for newEdge to reuse.
+    //  cellEdges is scratch space.
+    void Graph::streamCell(int32_t cell, std::vector<char>& edgeDone,
+                           std::vector<int>& cellEdges,
+                           const CellCallback& onCell)
     {
+        //  closing the cell drops the half edges of rejected edges, which
+        //  are released all the same
+        cellEdges.clear();
+        edgeDone.resize(_edges.size(), 0);
+        for (auto& halfEdge : _cells[cell].halfEdges)
+        {
+            cellEdges.push_back(halfEdge.edge);
+            if (edgeDone[halfEdge.edge])
+                continue;
+            edgeDone[halfEdge.edge] = 1;
+            if (finalizeEdge(halfEdge.edge))
+                markCellsToClose(halfEdge.edge);
+        }
 
-        Graph graph(xBound, yBound, std::move(sites));
+        closeCell(cell, _edges, 0);
+        edgeDone.resize(_edges.size(), 1);
+        for (auto& halfEdge : _cells[cell].halfEdges)
+        {
+            if (_edges[halfEdge.edge].rightSite < 0)
+            {
+                edgeDone[halfEdge.edge] = 2;
+                cellEdges.push_back(halfEdge.edge);
+            }
+        }
 
-        Sites& graphSites = graph._sites;
-        
-        
+        if (_options.cellMetrics)
+            measureCell(cell);
+
+        onCell(*this, cell);
+        HalfEdges().swap(_cells[cell].halfEdges);
+
+        for (int edge : cellEdges)
+        {
+            if (edgeDone[edge] == 2)
+            {
+                edgeDone[edge] = 0;
+                _freeEdges.push_back(edge);
+            }
+            else
+            {
+                edgeDone[edge] = 2;
+            }
+        }
+    }
+
+    ///////////////////////////////////////////////////////////////////////////
+    //  clipEdges leaves rejected edges in place (half edges refer to edges
+    //  by index), which closeCells already skips.  Compacting moves the
+    //  live edges down in one pass, then rewrites every half edge through
+    //  the index map in a second, dropping those of removed edges.
+    void Graph::compact()
+    {
+        std::vector<int> remap(_edges.size(), -1);
+        int live = 0;
+        for (int i = 0; i < (int)_edges.size(); ++i)
+        {
+            const Edge& edge = _edges[i];
+            if (!edge.p0 || !edge.p1 ||
+                isPointLike(edge))
+                continue;
+            if (live != i)
+                _edges[live] = _edges[i];
+            remap[i] = live++;
+        }
+        _edges.resize(live);
+        _edges.shrink_to_fit();
+
+        bool dropped = false;
+        for (auto& cell : _cells)
+        {
+            HalfEdges& halfEdges = cell.halfEdges;
+            for (HalfEdge& halfEdge : halfEdges)
+                halfEdge.edge = remap[halfEdge.edge];
+            auto end = std::remove_if(halfEdges.begin(), halfEdges.end(),
+                                      [](const HalfEdge& halfEdge)
+                                      {
+                                          return halfEdge.edge < 0;
+                                      });
+            dropped |= end != halfEdges.end();
+            halfEdges.erase(end, halfEdges.end());
+            halfEdges.shrink_to_fit();
+        }
+        _cells.shrink_to_fit();
+
+        //  the topology numbers half edges, not edges
+        if (dropped && !_topology.cellHalfEdges.empty())
+            linkHalfEdges();
+    }
+
+    //  Runs the sweep over the graph's sites, calling circleDone() after
+    //  every circle event.
+    template<typename CircleDone>
+    void Graph::sweep(Fortune& fortune, CircleDone circleDone)
+    {
         //  sort the sites, lowest Y - highest priority (the first in the
         //  vector.)
         //  we'll iterate through every site, begin to end but otherwise
         //  keep all the sites within vector - our edges and cells will
         //  point to sites within this vector
         std::vector<int> siteEvents;
-        siteEvents.reserve(graphSites.size());
+        siteEvents.reserve(_siteCount);
         
-        const Site* siteData = graphSites.data();
         size_t i = 0;
-        const Site* lastSiteData = nullptr;
+        Vertex lastSite = Vertex::undefined;
         
-        while (i < graphSites.size())
+        while (i < _siteCount)
         {
             //  remove duplicates
-            if (!lastSiteData || *lastSiteData != *siteData)
+            Vertex site = sitePosition((int)i);
+            if (!i || lastSite != site)
             {
                 siteEvents.push_back((int)i);
             }
-            lastSiteData = siteData;
-            ++siteData;
+            lastSite = site;
             ++i;
         }
         std::sort(siteEvents.begin(), siteEvents.end(),
-            [&graphSites](const int& site1, const int& site2)
+            [this](const int& site1, const int& site2)
             {
-            	const Site& r2 = graphSites[site2];
-                const Site& r1 = graphSites[site1];
+            	const Vertex r2 = sitePosition(site2);
+                const Vertex r1 = sitePosition(site1);
                 if (r2.y > r1.y)
                     return true;
                 if (r2.y < r1.y)
@@ -2162,12 +3373,10 @@ namespace cinekine
             });
 
         //  generate Cells container
-        Cells& cells = graph._cells;
+        Cells& cells = _cells;
         
         cells.reserve(siteEvents.size());
 
-        Fortune fortune(graph);
-
         //  iterate through all events, generating the beachline
         
         auto siteIt = siteEvents.begin();
@@ -2177,29 +3386,26 @@ namespace cinekine
             auto circle = fortune.circleEvent();
             
             int siteIndex = (siteIt != siteEvents.end()) ? *siteIt : -1;
-            Site* site = siteIndex >= 0 ? &graphSites[siteIndex] : nullptr;
+            Vertex site = siteIndex >= 0 ? sitePosition(siteIndex)
+                                         : Vertex::undefined;
 
             // new site?  create its cell and parabola (beachline segment)
             
-            if (site && (!circle ||
-                         site->y < circle->y ||
-                         (site->y == circle->y && site->x < circle->x)))
+            if (siteIndex >= 0 && (!circle ||
+                         site.y < circle->y ||
+                         (site.y == circle->y && site.x < circle->x)))
             {
-                //printf("Site: (%.2f,%.2f)\n", site->x, site->y);
+                //printf("Site: (%.2f,%.2f)\n", site.x, site.y);
                 cells.emplace_back(siteIndex);
-                site->cell = (int)cells.size()-1;
+                siteCellRef(siteIndex) = (int)cells.size()-1;
                 
                 fortune.addBeachSection(siteIndex);
-                if (site)           //  site will be null if at end()
-                {
-                	
-                    ++siteIt;
-                    
-                }
+                ++siteIt;
             }
             else if (circle)
             {
                 fortune.removeBeachSection(circle->arc);
+                circleDone();
                 
             }
             else
@@ -2208,6 +3414,20 @@ namespace cinekine
                 break;
             }
         }
+    }
+
+    //  a method for constructing a voronoi graph
+    //  
+    Graph build(Sites&& sites, float xBound, float yBound,
+                const BuildOptions& options)
+    {
+        if (options.periodic)
+            return buildPeriodic(std::move(sites), xBound, yBound, options);
+
+        Graph graph(xBound, yBound, std::move(sites), options);
+
+        Fortune fortune(graph, options);
+        graph.sweep(fortune, []() {});
 
         // wrapping-up:
         //   connect dangling edges to bounding box
@@ -2220,13 +3440,2496 @@ namespace cinekine
         //   add missing edges in order to close opened cells
         graph.closeCells();
 
+        if (options.compact)
+            graph.compact();
+
         // TODO: there are BeachArc leaks - we should keep track
         // of the active arcs and free them here.
   
         return graph;
     }
 
+    //  Builds a graph from coordinates held by the caller.  The coordinates
+    //  are read in place for the life of the graph (so must outlive it),
+    //  and each site's cell is kept in an array of the graph's own; read
+    //  them through Graph::siteCount/sitePosition/siteCell, sites() being
+    //  empty.  The sites are copied only for periodic graphs, which are
+    //  built from Sites.
+    Graph build(const SiteView& sites, float xBound, float yBound,
+                const BuildOptions& options)
+    {
+        if (options.periodic)
+        {
+            Sites copy;
+            copy.reserve(sites.count);
+            for (size_t i = 0; i < sites.count; ++i)
+            {
+                const size_t offset = i * sites.stride;
+                copy.emplace_back(Vertex(
+                    *(const float*)((const char*)sites.x + offset),
+                    *(const float*)((const char*)sites.y + offset)));
+            }
+            return build(std::move(copy), xBound, yBound, options);
+        }
+
+        Graph graph(xBound, yBound, sites, options);
+
+        Fortune fortune(graph, options);
+        graph.sweep(fortune, []() {});
+
+        graph.clipEdges();
+        graph.closeCells();
+
+        if (options.compact)
+            graph.compact();
+
+        return graph;
+    }
+
+    ///////////////////////////////////////////////////////////////////////////
+    //  Streaming builds
+    //
+    //  A site whose last arc leaves the beachline can't gain any more edges,
+    //  and every edge it has is complete.  Its cell is clipped, closed and
+    //  handed to onCell right after that circle event, then its half edges
+    //  are released, and so is each edge once both its cells have been
+    //  handed over, its slot going to the next edge created.  Consumers
+    //  overlap with the rest of the sweep, and the graph holds the half
+    //  edges and edges of the cells still on the beachline only (about
+    //  sqrt(N) for evenly spread sites), besides a site and an empty cell
+    //  per site.  Cells on the convex hull stay on the beachline to the end
+    //  and follow once the sweep is done.
+    //
+    //  During onCell the cell and the edges it refers to are final, and
+    //  Graph::getHalfEdgeStartpoint/Endpoint may be used on it; the graph is
+    //  otherwise under construction, and edges of cells handed over before
+    //  may have been reused.  The returned graph holds all sites, and cell
+    //  metrics when requested, but no edges, and its cells have no half
+    //  edges (compact and topology don't apply.)  Cells are emitted in the
+    //  order they become final, and finalizing runs on the sweep's thread
+    //  (finalizeThreads is ignored.)  Periodic graphs are built whole and
+    //  then emitted.
+    Graph buildStreaming(Sites&& sites, float xBound, float yBound,
+                         const CellCallback& onCell,
+                         const BuildOptions& options)
+    {
+        if (options.periodic)
+        {
+            Graph graph = build(std::move(sites), xBound, yBound, options);
+            for (int32_t cell = 0; cell < (int32_t)graph._cells.size();
+                 ++cell)
+            {
+                onCell(graph, cell);
+                HalfEdges().swap(graph._cells[cell].halfEdges);
+            }
+            return graph;
+        }
+
+        Graph graph(xBound, yBound, std::move(sites), options);
+
+        //  there is at most one cell per site
+        if (options.cellMetrics)
+            graph._cellMetrics.resize(graph._siteCount);
+
+        std::vector<char> edgeDone;
+        std::vector<int> cellEdges;
+        std::vector<char> cellDone(graph._siteCount, 0);
+
+        Fortune fortune(graph, options);
+        fortune.trackFinishedSites();
+        graph.sweep(fortune, [&]()
+        {
+            for (int site : fortune.finishedSites())
+            {
+                int32_t cell = graph.siteCell(site);
+                cellDone[cell] = 1;
+                graph.streamCell(cell, edgeDone, cellEdges, onCell);
+            }
+            fortune.finishedSites().clear();
+        });
+
+        //  the cells left on the beachline; released slots hold no edge
+        const int numEdges = (int)graph._edges.size();
+        edgeDone.resize(numEdges, 0);
+        for (int edge : graph._freeEdges)
+            edgeDone[edge] = 1;
+        for (int i = 0; i < numEdges; ++i)
+        {
+            if (edgeDone[i])
+                continue;
+            if (graph.finalizeEdge(i))
+                graph.markCellsToClose(i);
+            edgeDone[i] = 1;
+        }
+        for (int32_t cell = 0; cell < (int32_t)graph._cells.size(); ++cell)
+        {
+            if (!cellDone[cell])
+                graph.streamCell(cell, edgeDone, cellEdges, onCell);
+        }
+
+        //  every edge went with its cells
+        Edges().swap(graph._edges);
+        std::vector<int>().swap(graph._freeEdges);
+
+        if (options.cellMetrics)
+            graph._cellMetrics.resize(graph._cells.size());
+
+        return graph;
+    }
+
+    //  Whether every cell of the first siteCount sites of an extended
+    //  (guard band) graph is exact: the empty circle around each of its
+    //  vertices must lie within the extended bounds, otherwise a site
+    //  beyond the band could still cut into the cell.  Cells without edges
+    //  are not held against the band.
+    static bool periodicCellsResolved(const Graph& graph, int siteCount,
+                                      float xBound, float yBound)
+    {
+        const Sites& sites = graph.sites();
+        for (int i = 0; i < siteCount; ++i)
+        {
+            const Site& site = sites[i];
+            if (site.cell < 0)
+                continue;
+            //  a cell collapsed to a point (sites closer than the edge
+            //  tolerance) stays so however wide the band, so it is skipped
+            const Cell& cell = graph.cells()[site.cell];
+            for (auto& halfEdge : cell.halfEdges)
+            {
+                Vertex v = graph.getHalfEdgeStartpoint(halfEdge);
+                float room = std::min(std::min(v.x, xBound - v.x),
+                                      std::min(v.y, yBound - v.y));
+                float dx = v.x - site.x, dy = v.y - site.y;
+                if (!(room > 0.0f) || dx*dx + dy*dy >= room*room)
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    ///////////////////////////////////////////////////////////////////////////
+    //  Periodic (toroidal) graphs
+    //
+    //  Sites are wrapped into [0,xBound)x[0,yBound).  Rather than tiling the
+    //  domain 3x3, only the sites within a guard band of the border are
+    //  replicated, and the band is widened until every cell is provably
+    //  unaffected by sites beyond it (see periodicCellsResolved), so the
+    //  build costs about as much as an N site build.
+    //
+    //  The result has one cell per site and no border edges.  A cell
+    //  crossing the domain border is given in its site's frame, hence may
+    //  extend beyond the bounds.  An edge between two sites across the
+    //  border is stored once, in its left site's frame, with Edge::wrapX/
+    //  wrapY giving the offset to its right site's frame; use
+    //  Graph::getHalfEdgeStartpoint/Endpoint to walk cells.  An edge
+    //  between a site and one of its own images is stored once per side.
+    Graph buildPeriodic(Sites&& sites, float xBound, float yBound,
+                        const BuildOptions& options)
+    {
+        BuildOptions extendedOptions = options;
+        extendedOptions.periodic = false;
+        extendedOptions.cellMetrics = false;
+        extendedOptions.compact = false;
+        extendedOptions.topology = false;
+
+        const int siteCount = (int)sites.size();
+        for (auto& site : sites)
+        {
+            site.x = std::fmod(site.x, xBound);
+            if (site.x < 0.0f)
+                site.x += xBound;
+            site.y = std::fmod(site.y, yBound);
+            if (site.y < 0.0f)
+                site.y += yBound;
+            // fmod may round up to the bound itself
+            if (site.x >= xBound)
+                site.x = 0.0f;
+            if (site.y >= yBound)
+                site.y = 0.0f;
+        }
+
+        //  a few average site spacings is enough for all but degenerate
+        //  input
+        float spacing = std::sqrt(xBound*yBound / std::max(siteCount, 1));
+        const float maxMargin = std::max(xBound, yBound);
+        float margin = std::min(3.0f*spacing, maxMargin);
+
+        Graph extended;
+        std::vector<int> ghostSite;
+        std::vector<short> ghostWrapX, ghostWrapY;
+
+        for (;;)
+        {
+            Sites extendedSites;
+            extendedSites.reserve(siteCount + siteCount/4);
+            ghostSite.clear();
+            ghostWrapX.clear();
+            ghostWrapY.clear();
+
+            for (auto& site : sites)
+                extendedSites.emplace_back(Vertex(site.x+margin, site.y+margin));
+
+            const int kx = (int)std::ceil(margin / xBound);
+            const int ky = (int)std::ceil(margin / yBound);
+            for (int i = 0; i < siteCount; ++i)
+            {
+                const Site& site = sites[i];
+                for (int wy = -ky; wy <= ky; ++wy)
+                {
+                    float y = site.y + wy*yBound;
+                    if (y < -margin || y >= yBound+margin)
+                        continue;
+                    for (int wx = -kx; wx <= kx; ++wx)
+                    {
+                        float x = site.x + wx*xBound;
+                        if ((!wx && !wy) || x < -margin || x >= xBound+margin)
+                            continue;
+                        extendedSites.emplace_back(Vertex(x+margin, y+margin));
+                        ghostSite.push_back(i);
+                        ghostWrapX.push_back((short)wx);
+                        ghostWrapY.push_back((short)wy);
+                    }
+                }
+            }
+
+            extended = build(std::move(extendedSites),
+                             xBound + 2*margin, yBound + 2*margin,
+                             extendedOptions);
+
+            //  a band as wide as the domain already holds every site's
+            //  nearest images (the 3x3 tiling), so widening stops there
+            if (margin >= maxMargin ||
+                periodicCellsResolved(extended, siteCount,
+                                      xBound + 2*margin, yBound + 2*margin))
+                break;
+
+            margin = std::min(2.0f*margin, maxMargin);
+        }
+
+        Graph graph(xBound, yBound, std::move(sites), options);
+        graph._nearestSiteCells = false;
+        Cells& cells = graph._cells;
+        Edges& edges = graph._edges;
+        cells.reserve(siteCount);
+        edges.reserve(3*siteCount);
+
+        //  edges between two original sites map one to one, edges towards a
+        //  ghost are matched up with their counterpart across the border
+        std::vector<int> edgeMap(extended._edges.size(), -1);
+        std::map<std::tuple<int,int,int,int>, int> wrappedEdges;
+
+        for (auto& extendedCell : extended._cells)
+        {
+            const int site = extendedCell.site;
+            if (site >= siteCount)
+                continue;
+
+            cells.emplace_back(site);
+            graph._sites[site].cell = (int)cells.size()-1;
+            HalfEdges& halfEdges = cells.back().halfEdges;
+            halfEdges.reserve(extendedCell.halfEdges.size());
+
+            for (auto& extendedHalfEdge : extendedCell.halfEdges)
+            {
+                const Edge& extendedEdge = extended._edges[extendedHalfEdge.edge];
+                int other = extendedEdge.leftSite == site ? extendedEdge.rightSite :
+                                                            extendedEdge.leftSite;
+                int wrapX = 0, wrapY = 0;
+                if (other >= siteCount)
+                {
+                    wrapX = ghostWrapX[other-siteCount];
+                    wrapY = ghostWrapY[other-siteCount];
+                    other = ghostSite[other-siteCount];
+                }
+
+                int* edgeIdx;
+                int selfEdge = -1;
+                if (!wrapX && !wrapY)
+                {
+                    edgeIdx = &edgeMap[extendedHalfEdge.edge];
+                }
+                else if (other == site)
+                {
+                    edgeIdx = &selfEdge;
+                }
+                else
+                {
+                    auto key = site < other ?
+                        std::make_tuple(site, other, wrapX, wrapY) :
+                        std::make_tuple(other, site, -wrapX, -wrapY);
+                    edgeIdx = &wrappedEdges.insert(std::make_pair(key, -1)).first->second;
+                }
+
+                if (*edgeIdx < 0)
+                {
+                    Vertex va = extended.getHalfEdgeStartpoint(extendedHalfEdge);
+                    Vertex vb = extended.getHalfEdgeEndpoint(extendedHalfEdge);
+                    edges.emplace_back(site, other);
+                    Edge& edge = edges.back();
+                    edge.p0 = Vertex(va.x - margin, va.y - margin);
+                    edge.p1 = Vertex(vb.x - margin, vb.y - margin);
+                    edge.wrapX = (short)wrapX;
+                    edge.wrapY = (short)wrapY;
+                    *edgeIdx = (int)edges.size()-1;
+                }
+
+                HalfEdge halfEdge = extendedHalfEdge;
+                halfEdge.site = site;
+                halfEdge.edge = *edgeIdx;
+                halfEdges.push_back(halfEdge);
+            }
+        }
+
+        if (options.cellMetrics)
+        {
+            graph._cellMetrics.resize(cells.size());
+            for (int iCell = 0; iCell < (int)cells.size(); ++iCell)
+                graph.measureCell(iCell);
+        }
+
+        if (options.topology)
+            graph.linkHalfEdges();
+
+        if (options.compact)
+            graph.compact();
+
+        return graph;
+    }
+
+    ///////////////////////////////////////////////////////////////////////////
+    //  Sampled segments
+    //
+    //  An approximation, not segment sites: the sweep only knows point
+    //  sites, so a segment is represented by point samples along it and
+    //  its region is the union of their cells.
+    //  Samples are placed adaptively: a sample spacing h puts the distance
+    //  to the segment off by at most h^2/(8d) at distance d, so spacing is
+    //  only refined where a cell bordering another segment's region is
+    //  close enough to its segment for that to exceed the tolerance.
+    //  Bisectors between segments and points come out as polylines within
+    //  the tolerance of the true parabolic arcs.  Each refinement sweeps
+    //  all the samples again, so m samples cost O(m log m) per pass, for
+    //  up to 17 passes, and m grows as tolerance shrinks.
+
+    //  distance from p to segment ab
+    static float segmentDistance(const Vertex& p, const Vertex& a,
+                                 const Vertex& b)
+    {
+        float dx = b.x - a.x, dy = b.y - a.y;
+        float len2 = dx*dx + dy*dy;
+        float t = len2 > 0.0f ? ((p.x-a.x)*dx + (p.y-a.y)*dy) / len2 : 0.0f;
+        t = std::max(0.0f, std::min(1.0f, t));
+        float ex = a.x + t*dx - p.x, ey = a.y + t*dy - p.y;
+        return std::sqrt(ex*ex + ey*ey);
+    }
+
+    //  Approximates the Voronoi diagram of non-crossing line segments
+    //  (which may share end points) within [0,xBound]x[0,yBound] from
+    //  point samples along them.  Degenerate segments act as point sites.
+    //
+    //  The graph has one site and one cell per segment: site i, at the
+    //  middle of segment i, has cell i, and every edge runs between the
+    //  sites of the segments on either side of it.  Half edges are
+    //  clockwise, as usual, but cells need not be convex.  A segment with
+    //  no sample of its own (a degenerate one lying on another segment's
+    //  sample, or one outside the bounds) has an edgeless cell.  Cells are
+    //  nearest segment regions, not nearest site ones (see
+    //  Graph::nearestSiteCells.)
+    //
+    //  tolerance bounds the error in distance of the region boundaries;
+    //  samples are never spaced closer than it.
+    Graph buildSampledSegments(const Segments& segments, float xBound,
+                               float yBound, float tolerance,
+                               const BuildOptions& options)
+    {
+        const int segmentCount = (int)segments.size();
+        const int maxRefinements = 16;
+
+        BuildOptions sampleOptions = options;
+        sampleOptions.cellMetrics = false;
+        sampleOptions.periodic = false;
+        sampleOptions.compact = false;
+        sampleOptions.topology = false;
+
+        //  initial spacing, assuming segments are about evenly spread out
+        float clearance = 0.5f * std::sqrt(xBound*yBound /
+                                           std::max(segmentCount, 1));
+        float spacing = std::max(tolerance,
+                                 std::sqrt(8.0f*tolerance*clearance));
+
+        //  sample parameters along each segment, in [0,1]
+        std::vector<std::vector<float>> params(segmentCount);
+        std::vector<float> lengths(segmentCount);
+        for (int s = 0; s < segmentCount; ++s)
+        {
+            const Segment& segment = segments[s];
+            float dx = segment.p1.x - segment.p0.x;
+            float dy = segment.p1.y - segment.p0.y;
+            lengths[s] = std::sqrt(dx*dx + dy*dy);
+            if (lengths[s] == 0.0f)
+            {
+                params[s].push_back(0.0f);
+                continue;
+            }
+            int intervals = std::max(1, (int)std::ceil(lengths[s] / spacing));
+            for (int k = 0; k <= intervals; ++k)
+                params[s].push_back((float)k / intervals);
+        }
+
+        Graph graph;
+        std::vector<int> siteSegments;
+        std::vector<int> siteSamples;
+
+        for (int refinement = 0; ; ++refinement)
+        {
+            //  sample, dropping samples shared with another segment (end
+            //  points in common) so no two sites coincide
+            Sites sites;
+            siteSegments.clear();
+            siteSamples.clear();
+            for (int s = 0; s < segmentCount; ++s)
+            {
+                const Segment& segment = segments[s];
+                for (int k = 0; k < (int)params[s].size(); ++k)
+                {
+                    float t = params[s][k];
+                    sites.emplace_back(Vertex(
+                        segment.p0.x + t*(segment.p1.x - segment.p0.x),
+                        segment.p0.y + t*(segment.p1.y - segment.p0.y)));
+                    siteSegments.push_back(s);
+                    siteSamples.push_back(k);
+                }
+            }
+
+            std::vector<int> order(sites.size());
+            for (int i = 0; i < (int)order.size(); ++i)
+                order[i] = i;
+            std::sort(order.begin(), order.end(),
+                [&sites](int a, int b)
+                {
+                    if (sites[a].y != sites[b].y)
+                        return sites[a].y < sites[b].y;
+                    if (sites[a].x != sites[b].x)
+                        return sites[a].x < sites[b].x;
+                    return a < b;
+                });
+            std::vector<char> keep(sites.size(), 1);
+            for (size_t i = 1; i < order.size(); ++i)
+            {
+                if (sites[order[i]] == sites[order[i-1]])
+                    keep[order[i]] = 0;
+            }
+            size_t kept = 0;
+            for (size_t i = 0; i < sites.size(); ++i)
+            {
+                if (!keep[i])
+                    continue;
+                sites[kept] = sites[i];
+                siteSegments[kept] = siteSegments[i];
+                siteSamples[kept] = siteSamples[i];
+                ++kept;
+            }
+            sites.resize(kept);
+            siteSegments.resize(kept);
+            siteSamples.resize(kept);
+
+            graph = build(std::move(sites), xBound, yBound, sampleOptions);
+
+            if (refinement == maxRefinements)
+                break;
+
+            //  split the intervals around samples whose cell boundary with
+            //  another segment is not resolved to within the tolerance
+            std::vector<std::vector<char>> split(segmentCount);
+            for (int s = 0; s < segmentCount; ++s)
+                split[s].assign(params[s].size(), 0);
+            bool refine = false;
+
+            const Sites& graphSites = graph.sites();
+            for (int i = 0; i < (int)graphSites.size(); ++i)
+            {
+                if (graphSites[i].cell < 0)
+                    continue;
+                const int s = siteSegments[i];
+                const int k = siteSamples[i];
+                const std::vector<float>& ts = params[s];
+                if (ts.size() < 2)
+                    continue;
+
+                float before = k > 0 ? ts[k] - ts[k-1] : 0.0f;
+                float after = k+1 < (int)ts.size() ? ts[k+1] - ts[k] : 0.0f;
+                float h = std::max(before, after) * lengths[s];
+                if (h <= tolerance)
+                    continue;
+
+                const Segment& segment = segments[s];
+                const Cell& cell = graph.cells()[graphSites[i].cell];
+                for (auto& halfEdge : cell.halfEdges)
+                {
+                    const Edge& edge = graph.edges()[halfEdge.edge];
+                    int other = edge.leftSite == i ? edge.rightSite :
+                                                     edge.leftSite;
+                    if (other < 0 || siteSegments[other] == s)
+                        continue;
+
+                    float d = std::min(
+                        segmentDistance(graph.getHalfEdgeStartpoint(halfEdge),
+                                        segment.p0, segment.p1),
+                        segmentDistance(graph.getHalfEdgeEndpoint(halfEdge),
+                                        segment.p0, segment.p1));
+                    if (h*h > 8.0f*tolerance*d)
+                    {
+                        if (k > 0)
+                            split[s][k-1] = 1;
+                        if (k+1 < (int)ts.size())
+                            split[s][k] = 1;
+                        refine = true;
+                        break;
+                    }
+                }
+            }
+
+            if (!refine)
+                break;
+
+            for (int s = 0; s < segmentCount; ++s)
+            {
+                std::vector<float> ts;
+                ts.reserve(params[s].size() * 2);
+                for (size_t k = 0; k < params[s].size(); ++k)
+                {
+                    ts.push_back(params[s][k]);
+                    if (split[s][k] &&
+                        (params[s][k+1] - params[s][k]) * lengths[s] > tolerance)
+                    {
+                        ts.push_back(0.5f * (params[s][k] + params[s][k+1]));
+                    }
+                }
+                params[s].swap(ts);
+            }
+        }
+
+        //  merge the sample cells of each segment: walk the boundary of
+        //  the union, crossing over to the neighbouring sample cell through
+        //  each edge internal to the segment
+        Cells& sampleCells = graph._cells;
+        const Edges& edges = graph._edges;
+        Sites& sites = graph._sites;
+
+        auto otherSite = [&edges](const HalfEdge& halfEdge)
+        {
+            const Edge& edge = edges[halfEdge.edge];
+            return edge.leftSite == halfEdge.site ? edge.rightSite :
+                                                    edge.leftSite;
+        };
+        auto internal = [&](const HalfEdge& halfEdge)
+        {
+            int other = otherSite(halfEdge);
+            return other >= 0 &&
+                   siteSegments[other] == siteSegments[halfEdge.site];
+        };
+
+        std::vector<std::vector<int>> segmentSites(segmentCount);
+        for (int i = 0; i < (int)sites.size(); ++i)
+        {
+            if (sites[i].cell >= 0)
+                segmentSites[siteSegments[i]].push_back(i);
+        }
+        //  a segment left without a sample of its own (a degenerate one on
+        //  another segment's sample, or one outside the bounds) still gets
+        //  a site, at its first end point, for its edgeless cell
+        for (int s = 0; s < segmentCount; ++s)
+        {
+            if (!segmentSites[s].empty())
+                continue;
+            segmentSites[s].push_back((int)sites.size());
+            sites.emplace_back(segments[s].p0);
+            siteSegments.push_back(s);
+        }
+
+        Cells cells;
+        cells.reserve(segmentCount);
+        for (int s = 0; s < segmentCount; ++s)
+        {
+            cells.emplace_back(segmentSites[s][0]);
+            HalfEdges& halfEdges = cells.back().halfEdges;
+
+            size_t boundaryCount = 0;
+            int startCell = -1, startEdge = -1;
+            for (int site : segmentSites[s])
+            {
+                if (sites[site].cell < 0)
+                    continue;
+                const HalfEdges& sampleEdges =
+                    sampleCells[sites[site].cell].halfEdges;
+                for (int j = 0; j < (int)sampleEdges.size(); ++j)
+                {
+                    if (internal(sampleEdges[j]))
+                        continue;
+                    if (startCell < 0)
+                    {
+                        startCell = sites[site].cell;
+                        startEdge = j;
+                    }
+                    ++boundaryCount;
+                }
+            }
+            if (startCell < 0)
+                continue;
+
+            //  the walk is bounded by the boundary half edge count, should
+            //  clipping have left the sample cells inconsistent
+            int iCell = startCell, iEdge = startEdge;
+            bool linked = true;
+            do
+            {
+                halfEdges.push_back(sampleCells[iCell].halfEdges[iEdge]);
+
+                const HalfEdges* sampleEdges = &sampleCells[iCell].halfEdges;
+                iEdge = (iEdge + 1) % (int)sampleEdges->size();
+                while (linked && internal((*sampleEdges)[iEdge]))
+                {
+                    const int edge = (*sampleEdges)[iEdge].edge;
+                    iCell = sites[otherSite((*sampleEdges)[iEdge])].cell;
+                    sampleEdges = &sampleCells[iCell].halfEdges;
+                    auto twin = std::find_if(sampleEdges->begin(),
+                                             sampleEdges->end(),
+                                             [edge](const HalfEdge& halfEdge)
+                                             {
+                                                return halfEdge.edge == edge;
+                                             });
+                    linked = twin != sampleEdges->end();
+                    if (linked)
+                    {
+                        iEdge = (int)((twin - sampleEdges->begin() + 1) %
+                                      sampleEdges->size());
+                    }
+                }
+            }
+            while (linked && (iCell != startCell || iEdge != startEdge) &&
+                   halfEdges.size() < boundaryCount);
+        }
+
+        //  the samples give way to the segments, site s (at the middle of
+        //  segment s) for cell s: the edges the cells kept are taken over
+        //  with their samples' segments as their sites, and the others, all
+        //  between samples of one segment, are dropped
+        std::vector<int> remap(edges.size(), -1);
+        Edges segmentEdges;
+        for (int s = 0; s < segmentCount; ++s)
+        {
+            for (HalfEdge& halfEdge : cells[s].halfEdges)
+            {
+                int& edge = remap[halfEdge.edge];
+                if (edge < 0)
+                {
+                    edge = (int)segmentEdges.size();
+                    segmentEdges.push_back(edges[halfEdge.edge]);
+                    Edge& segmentEdge = segmentEdges.back();
+                    segmentEdge.leftSite = siteSegments[segmentEdge.leftSite];
+                    if (segmentEdge.rightSite >= 0)
+                    {
+                        segmentEdge.rightSite =
+                            siteSegments[segmentEdge.rightSite];
+                    }
+                }
+                halfEdge.edge = edge;
+                halfEdge.site = s;
+            }
+            cells[s].site = s;
+        }
+        sites.clear();
+        for (int s = 0; s < segmentCount; ++s)
+        {
+            const Segment& segment = segments[s];
+            sites.emplace_back(Vertex(0.5f * (segment.p0.x + segment.p1.x),
+                                      0.5f * (segment.p0.y + segment.p1.y)));
+            sites.back().cell = s;
+        }
+        graph.bindSites();
+        sampleCells.swap(cells);
+        graph._edges.swap(segmentEdges);
+        graph._nearestSiteCells = false;
+        graph._options = options;
+
+        if (options.cellMetrics)
+        {
+            graph._cellMetrics.resize(segmentCount);
+            for (int iCell = 0; iCell < segmentCount; ++iCell)
+                graph.measureCell(iCell);
+        }
+
+        if (options.topology)
+            graph.linkHalfEdges();
+
+        if (options.compact)
+            graph.compact();
+
+        return graph;
+    }
+
+    ///////////////////////////////////////////////////////////////////////////
+    //  Metric graphs
+    //
+    //  Under the Manhattan and Chebyshev metrics bisectors bend, and the
+    //  sweep's edges, completed and clipped along straight bisectors, no
+    //  longer fit.  A cell is still star-shaped from its site (a point
+    //  nearer p than q keeps the whole segment back to p nearer), so each
+    //  cell is worked out on its own, in double precision, as a polygon
+    //  around its site: the bounds, lowered to each bisector wherever that
+    //  is nearer the site along a ray from it.  The other sites are taken
+    //  from a kd-tree over them, nearer subtrees first, skipping those more
+    //  than twice the cell's reach (the distance to its farthest corner)
+    //  away, beyond which a bisector can't come within the cell.  A cell
+    //  thus meets the sites within twice its reach and the subtrees around
+    //  them: a few dozen for evenly spread or clustered sites, so the build
+    //  is about O(n log n).  It is O(n^2) at worst, when many cells reach
+    //  across many sites, as for sites along a line across the bounds,
+    //  whose cells are strips as tall as the bounds.  Cells are independent
+    //  and split across finalizeThreads.  Settling the sides where
+    //  bisectors coincide (settlePolygonSides) then goes over every side
+    //  against its cell's neighbours and theirs, once per pass, a pass
+    //  more for each chain of parts settled by nearness.
+    //
+    //  This is not Fortune's sweep run under another metric, and has none
+    //  of its O(n log n) bound; that is why the metric is buildMetric's
+    //  own argument rather than a BuildOptions field build() would route.
+    //
+    //  Manhattan distance is Chebyshev distance in the plane turned by 45
+    //  degrees, (x + y, x - y), so bisectors are worked out as Chebyshev
+    //  ones and turned back.  The Chebyshev bisector of sites further apart
+    //  in x than in y runs along x = mid between two 45 degree rays.  Sites
+    //  level in y are equidistant from whole quadrants; those go to the
+    //  nearer site by Euclidean distance, leaving the line x = mid.  As the
+    //  tie-break is the same for every pair, the cells don't overlap.
+    //  Bisectors of different pairs can still run together, as on a grid
+    //  of sites; a cell then sees one side where it has several
+    //  neighbours, and which lies beyond each part is settled afterwards
+    //  from the neighbours' polygons.
+    //
+    //  Cells, edges and half edges are laid out by addPolygonCells: cells
+    //  in sweep order, edges owned by the lower numbered cell, no clipped away
+    //  or point-like edges, and half edges clockwise from the one with the
+    //  largest angle.  Of sites given more than once only the first gets a
+    //  cell, wherever the others are in the input.  A bisector gives an
+    //  edge per straight piece of it along the cell, and a half edge's
+    //  angle is that of its edge's midpoint as seen from the site.
+    //  Robustness, beachlineSearch and periodic don't apply.
+
+    //  a corner of a cell polygon: the side from it to the next corner runs
+    //  along the bisector with cell 'neighbor', or the bounds if that's < 0
+    struct MetricCorner
+    {
+        double x, y;
+        int neighbor;
+    };
+
+    //  The sites of a metric graph (distinct, in cell order), in a kd-tree
+    //  with up to metricLeafSites sites to a leaf.  Node n's children are
+    //  2n+1 and 2n+2, and its sites are a range of treeCells, halved
+    //  between the children at the middle of the range.
+    const int metricLeafSites = 8;
+
+    struct MetricSites
+    {
+        MetricSites(Metric metric, const std::vector<double>& xs,
+                    const std::vector<double>& ys,
+                    double xBound, double yBound);
+
+        struct Box
+        {
+            double x0, y0, x1, y1;
+        };
+
+        Metric metric;
+        const std::vector<double>& xs;
+        const std::vector<double>& ys;
+        double xBound, yBound;
+        //  how far bisector rays run, well outside any cell's polygon
+        double far;
+        std::vector<int> treeCells;
+        //  each node's sites' bounds
+        std::vector<Box> treeBoxes;
+
+    private:
+        void split(int node, int begin, int end);
+    };
+
+    /**
+     * @class MetricCells
+     * @brief Works out the cells of a metric graph one at a time, holding
+     *        the scratch space needed.  One per thread.
+     */
+    class MetricCells
+    {
+    public:
+        MetricCells(const MetricSites& sites);
+
+        //  cell's polygon, clockwise (y up) like the half edges
+        void cell(int cell, MetricPolygon& polygon);
+
+        static void clip(MetricPolygon& polygon, MetricPolygon& scratch,
+                         double nx, double ny, double c, int label = -1);
+
+    private:
+        struct Point
+        {
+            double x, y;
+        };
+        struct Direction
+        {
+            double angle;
+            Point point;
+        };
+        //  the side of the lowered polygon between two directions
+        struct Span
+        {
+            Point a, b;
+            int label;
+        };
+        //  a kd-tree node left to visit, its range of treeCells and how
+        //  far its sites are at least
+        struct TreeRange
+        {
+            double distance;
+            int node, begin, end;
+        };
+
+        double distance(double dx, double dy) const;
+        int bisector(int cell, int other, Point* points) const;
+        bool lower(double px, double py, const Point* points, int count,
+                   int neighbor);
+        static double hit(double px, double py, double dx, double dy,
+                          const Point& a, const Point& b);
+        static void simplify(MetricPolygon& polygon, double tiny);
+
+        const MetricSites& _sites;
+        MetricPolygon _polygon;
+        MetricPolygon _scratch;
+        std::vector<Direction> _directions;
+        std::vector<Span> _spans;
+        std::vector<TreeRange> _nodes;
+    };
+
+    MetricSites::MetricSites(Metric metric, const std::vector<double>& xs,
+                             const std::vector<double>& ys,
+                             double xBound, double yBound) :
+        metric(metric),
+        xs(xs),
+        ys(ys),
+        xBound(xBound), yBound(yBound)
+    {
+        const int count = (int)xs.size();
+        double x0 = 0.0, y0 = 0.0, x1 = xBound, y1 = yBound;
+        for (int c = 0; c < count; ++c)
+        {
+            x0 = std::min(x0, xs[c]);
+            x1 = std::max(x1, xs[c]);
+            y0 = std::min(y0, ys[c]);
+            y1 = std::max(y1, ys[c]);
+        }
+        far = 8.0 * std::max(std::max(x1 - x0, y1 - y0), 1.0);
+
+        treeCells.resize(count);
+        for (int c = 0; c < count; ++c)
+            treeCells[c] = c;
+        //  the ranges halve, so leaves are at most this deep
+        int leaves = 1;
+        while (leaves * metricLeafSites < count)
+            leaves *= 2;
+        treeBoxes.resize(2 * leaves - 1);
+        if (count)
+            split(0, 0, count);
+    }
+
+    //  bounds node's sites, [begin, end) of treeCells, and splits them
+    //  across the wider side of their bounds
+    void MetricSites::split(int node, int begin, int end)
+    {
+        Box box = { xs[treeCells[begin]], ys[treeCells[begin]],
+                    xs[treeCells[begin]], ys[treeCells[begin]] };
+        for (int i = begin + 1; i < end; ++i)
+        {
+            const int c = treeCells[i];
+            box.x0 = std::min(box.x0, xs[c]);
+            box.y0 = std::min(box.y0, ys[c]);
+            box.x1 = std::max(box.x1, xs[c]);
+            box.y1 = std::max(box.y1, ys[c]);
+        }
+        treeBoxes[node] = box;
+        if (end - begin <= metricLeafSites)
+            return;
+
+        const int middle = begin + (end - begin) / 2;
+        const std::vector<double>& axis =
+            box.x1 - box.x0 >= box.y1 - box.y0 ? xs : ys;
+        std::nth_element(treeCells.begin() + begin,
+                         treeCells.begin() + middle,
+                         treeCells.begin() + end,
+                         [&axis](int c0, int c1)
+                         {
+                             return axis[c0] < axis[c1];
+                         });
+        split(2*node + 1, begin, middle);
+        split(2*node + 2, middle, end);
+    }
+
+    MetricCells::MetricCells(const MetricSites& sites) :
+        _sites(sites)
+    {
+    }
+
+    double MetricCells::distance(double dx, double dy) const
+    {
+        dx = std::abs(dx);
+        dy = std::abs(dy);
+        return _sites.metric == Metric::Manhattan ? dx + dy :
+                                                    std::max(dx, dy);
+    }
+
+    //  The bisector of two cells' sites as a polyline of up to four points,
+    //  the first and last far beyond the bounds.  Worked out in the same
+    //  order whichever cell asks, so both see the same points.
+    int MetricCells::bisector(int cell, int other, Point* points) const
+    {
+        const int c0 = std::min(cell, other), c1 = std::max(cell, other);
+        double px = _sites.xs[c0], py = _sites.ys[c0];
+        double qx = _sites.xs[c1], qy = _sites.ys[c1];
+        const bool manhattan = _sites.metric == Metric::Manhattan;
+        if (manhattan)
+        {
+            const double pu = px + py, qu = qx + qy;
+            py = px - py;
+            qy = qx - qy;
+            px = pu;
+            qx = qu;
+        }
+        //  the sites are further apart in x than in y, or made so
+        const bool swapped = std::abs(qy - py) > std::abs(qx - px);
+        if (swapped)
+        {
+            std::swap(px, py);
+            std::swap(qx, qy);
+        }
+        const double dx = qx - px, dy = qy - py;
+        const double mx = (px + qx) * 0.5, my = (py + qy) * 0.5;
+        const double far = _sites.far;
+        int count;
+        if (dy == 0.0)
+        {
+            points[0] = { mx, my - far };
+            points[1] = { mx, my + far };
+            count = 2;
+        }
+        else
+        {
+            const double h = (std::abs(dx) - std::abs(dy)) * 0.5;
+            const double s = (dx > 0.0) == (dy > 0.0) ? 1.0 : -1.0;
+            count = 0;
+            points[count++] = { mx - s*far, my + h + far };
+            points[count++] = { mx, my + h };
+            if (h > 0.0)
+                points[count++] = { mx, my - h };
+            points[count++] = { mx + s*far, my - h - far };
+        }
+        for (int i = 0; i < count; ++i)
+        {
+            if (swapped)
+                std::swap(points[i].x, points[i].y);
+            if (manhattan)
+            {
+                const double u = points[i].x, w = points[i].y;
+                points[i].x = (u + w) * 0.5;
+                points[i].y = (u - w) * 0.5;
+            }
+        }
+        return count;
+    }
+
+    //  distance along the ray from (px, py) in direction (dx, dy), in units
+    //  of its length, to segment ab; infinite if the ray misses it
+    double MetricCells::hit(double px, double py, double dx, double dy,
+                            const Point& a, const Point& b)
+    {
+        const double ex = b.x - a.x, ey = b.y - a.y;
+        const double denominator = dx*ey - dy*ex;
+        if (denominator == 0.0)
+            return std::numeric_limits<double>::infinity();
+        const double ax = a.x - px, ay = a.y - py;
+        const double t = (ax*ey - ay*ex) / denominator;
+        const double s = (ax*dy - ay*dx) / denominator;
+        if (t <= 0.0 || s < -1e-9 || s > 1.0 + 1e-9)
+            return std::numeric_limits<double>::infinity();
+        return t;
+    }
+
+    //  Lowers the (counterclockwise, star-shaped) polygon around (px, py)
+    //  to the polyline wherever the polyline is nearer along a ray from
+    //  (px, py), returning whether it did.  The new corners are at the
+    //  directions of the old ones, of the polyline's bends and of their
+    //  crossings; each side is labelled by whichever is nearer between its
+    //  corners.
+    bool MetricCells::lower(double px, double py, const Point* points,
+                            int count, int neighbor)
+    {
+        const MetricSites& sites = _sites;
+        MetricPolygon& polygon = _polygon;
+        const int corners = (int)polygon.size();
+        std::vector<Direction>& directions = _directions;
+        directions.clear();
+
+        auto addDirection = [&directions, px, py](double x, double y)
+        {
+            Direction direction = { std::atan2(y - py, x - px), { x, y } };
+            directions.push_back(direction);
+        };
+        auto cornerPoint = [&polygon](int i)
+        {
+            Point point = { polygon[i].x, polygon[i].y };
+            return point;
+        };
+
+        //  the polyline's ends are outside the polygon, so it misses the
+        //  polygon unless it crosses a side
+        for (int i = 0; i < corners; ++i)
+        {
+            const Point a = cornerPoint(i);
+            const Point b = cornerPoint(i + 1 < corners ? i + 1 : 0);
+            for (int j = 0; j + 1 < count; ++j)
+            {
+                const Point& c = points[j];
+                const Point& d = points[j + 1];
+                const double ex = b.x - a.x, ey = b.y - a.y;
+                const double fx = d.x - c.x, fy = d.y - c.y;
+                const double denominator = ex*fy - ey*fx;
+                if (denominator == 0.0)
+                    continue;
+                const double t = ((c.x - a.x)*fy - (c.y - a.y)*fx) /
+                                 denominator;
+                const double s = ((c.x - a.x)*ey - (c.y - a.y)*ex) /
+                                 denominator;
+                if (t >= 0.0 && t <= 1.0 && s >= 0.0 && s <= 1.0)
+                    addDirection(a.x + t*ex, a.y + t*ey);
+            }
+        }
+        if (directions.empty())
+            return false;
+
+        for (int i = 0; i < corners; ++i)
+            addDirection(polygon[i].x, polygon[i].y);
+        for (int j = 1; j + 1 < count; ++j)
+            addDirection(points[j].x, points[j].y);
+        std::sort(directions.begin(), directions.end(),
+                  [](const Direction& a, const Direction& b)
+                  {
+                      return a.angle < b.angle;
+                  });
+
+        //  the nearer of the polygon and the polyline along a direction:
+        //  the side it hits there, ab, and that side's label
+        auto nearest = [&](double dx, double dy, Point& a, Point& b)
+        {
+            double polygonHit = std::numeric_limits<double>::infinity();
+            int label = -1;
+            for (int i = 0; i < corners; ++i)
+            {
+                const Point c = cornerPoint(i);
+                const Point d = cornerPoint(i + 1 < corners ? i + 1 : 0);
+                const double t = hit(px, py, dx, dy, c, d);
+                if (t < polygonHit)
+                {
+                    polygonHit = t;
+                    label = polygon[i].neighbor;
+                    a = c;
+                    b = d;
+                }
+            }
+            double lineHit = std::numeric_limits<double>::infinity();
+            int segment = -1;
+            for (int j = 0; j + 1 < count; ++j)
+            {
+                const double t = hit(px, py, dx, dy, points[j], points[j + 1]);
+                if (t < lineHit)
+                {
+                    lineHit = t;
+                    segment = j;
+                }
+            }
+            if (lineHit < polygonHit * (1.0 - 1e-9))
+            {
+                a = points[segment];
+                b = points[segment + 1];
+                return neighbor;
+            }
+            //  where two bisectors run together the sites are tied, and
+            //  the side goes to the nearer by Euclidean distance
+            if (lineHit <= polygonHit * (1.0 + 1e-9) && label >= 0)
+            {
+                const double x = px + lineHit*dx, y = py + lineHit*dy;
+                const double nx = sites.xs[neighbor] - x;
+                const double ny = sites.ys[neighbor] - y;
+                const double lx = sites.xs[label] - x;
+                const double ly = sites.ys[label] - y;
+                if (nx*nx + ny*ny < lx*lx + ly*ly)
+                    label = neighbor;
+            }
+            return label;
+        };
+
+        //  the sides between each direction and the next
+        std::vector<Span>& spans = _spans;
+        spans.clear();
+        const int directionCount = (int)directions.size();
+        const double twoPi = 6.283185307179586;
+        for (int i = 0; i < directionCount; ++i)
+        {
+            const Direction& direction = directions[i];
+            const Direction& next = directions[(i + 1) % directionCount];
+            double gap = next.angle - direction.angle;
+            if (i + 1 == directionCount)
+                gap += twoPi;
+            if (gap <= 1e-12)
+                continue;
+            const double middle = direction.angle + gap * 0.5;
+            Span span;
+            span.label = nearest(std::cos(middle), std::sin(middle),
+                                 span.a, span.b);
+            spans.push_back(span);
+        }
+        if (spans.empty())
+            return false;
+
+        //  A direction's corner is where the sides either side of it meet
+        //  it.  Where they meet it apart the polygon runs straight out from
+        //  the site there, and that side is labelled as the nearer one.
+        auto along = [px, py](const Span& span, double dx, double dy)
+        {
+            const double ex = span.b.x - span.a.x, ey = span.b.y - span.a.y;
+            const double denominator = dx*ey - dy*ex;
+            if (denominator == 0.0)
+                return std::numeric_limits<double>::infinity();
+            return ((span.a.x - px)*ey - (span.a.y - py)*ex) / denominator;
+        };
+        MetricPolygon& lowered = _scratch;
+        lowered.clear();
+        const int spanCount = (int)spans.size();
+        for (int i = 0, k = 0; i < directionCount; ++i)
+        {
+            const Direction& direction = directions[i];
+            const Direction& next = directions[(i + 1) % directionCount];
+            double gap = next.angle - direction.angle;
+            if (i + 1 == directionCount)
+                gap += twoPi;
+            if (gap <= 1e-12)
+                continue;
+            const Span& before = spans[(k + spanCount - 1) % spanCount];
+            const Span& after = spans[k++];
+            const double dx = direction.point.x - px;
+            const double dy = direction.point.y - py;
+            const double t0 = along(before, dx, dy);
+            const double t1 = along(after, dx, dy);
+            if (std::isfinite(t0) && std::isfinite(t1) &&
+                std::abs(t1 - t0) > 1e-9 * std::max(t0, t1))
+            {
+                MetricCorner corner = { px + t0*dx, py + t0*dy,
+                                        t0 < t1 ? before.label :
+                                                  after.label };
+                lowered.push_back(corner);
+            }
+            const double t = std::isfinite(t1) ? t1 : t0;
+            if (!std::isfinite(t))
+                continue;
+            MetricCorner corner = { px + t*dx, py + t*dy, after.label };
+            lowered.push_back(corner);
+        }
+
+        polygon.swap(lowered);
+        simplify(polygon, 1e-12 * (sites.xBound + sites.yBound));
+        return true;
+    }
+
+    //  Drops corners on top of the next one, and those in the middle of a
+    //  straight run of sides along the same bisector (or the bounds), so
+    //  neighbouring cells split their shared sides alike.
+    void MetricCells::simplify(MetricPolygon& polygon, double tiny)
+    {
+        size_t i = 0, kept = 0;
+        while (polygon.size() >= 3 && kept < polygon.size())
+        {
+            const size_t count = polygon.size();
+            i %= count;
+            const MetricCorner& a = polygon[(i + count - 1) % count];
+            const MetricCorner& b = polygon[i];
+            const MetricCorner& c = polygon[(i + 1) % count];
+            const double ux = b.x - a.x, uy = b.y - a.y;
+            const double vx = c.x - b.x, vy = c.y - b.y;
+            bool drop = std::abs(vx) + std::abs(vy) <= tiny;
+            if (!drop && a.neighbor == b.neighbor)
+            {
+                drop = std::abs(ux*vy - uy*vx) <=
+                       1e-9 * (std::abs(ux) + std::abs(uy)) *
+                              (std::abs(vx) + std::abs(vy));
+            }
+            if (drop)
+            {
+                polygon.erase(polygon.begin() + i);
+                kept = 0;
+            }
+            else
+            {
+                ++i;
+                ++kept;
+            }
+        }
+        if (polygon.size() < 3)
+            polygon.clear();
+    }
+
+    //  keeps the part of polygon where nx*x + ny*y <= c, the new side and
+    //  any already along the line labelled 'label', the bounds by default
+    void MetricCells::clip(MetricPolygon& polygon, MetricPolygon& scratch,
+                           double nx, double ny, double c, int label)
+    {
+        scratch.clear();
+        const double tiny = 1e-12 * (std::abs(c) + 1.0);
+        const size_t count = polygon.size();
+        for (size_t i = 0; i < count; ++i)
+        {
+            const MetricCorner& a = polygon[i];
+            const MetricCorner& b = polygon[(i + 1) % count];
+            const double da = nx*a.x + ny*a.y - c;
+            const double db = nx*b.x + ny*b.y - c;
+            if (da <= 0.0)
+            {
+                scratch.push_back(a);
+                if (da >= -tiny && db >= -tiny)
+                    scratch.back().neighbor = label;
+            }
+            if ((da < 0.0 && db > 0.0) || (da > 0.0 && db < 0.0))
+            {
+                const double t = da / (da - db);
+                MetricCorner p = { a.x + t*(b.x - a.x), a.y + t*(b.y - a.y),
+                                   da < 0.0 ? label : a.neighbor };
+                scratch.push_back(p);
+            }
+        }
+        polygon.swap(scratch);
+        if (polygon.size() < 3)
+            polygon.clear();
+    }
+
+    void MetricCells::cell(int cell, MetricPolygon& result)
+    {
+        const MetricSites& sites = _sites;
+        const double px = sites.xs[cell], py = sites.ys[cell];
+
+        //  the bounds, widened a little to hold the site strictly inside,
+        //  counterclockwise; cut back to the bounds at the end
+        const double margin = 1e-3 * (sites.xBound + sites.yBound) + 1e-6;
+        const double x0 = std::min(0.0, px) - margin;
+        const double y0 = std::min(0.0, py) - margin;
+        const double x1 = std::max(sites.xBound, px) + margin;
+        const double y1 = std::max(sites.yBound, py) + margin;
+        MetricPolygon& polygon = _polygon;
+        polygon.clear();
+        polygon.push_back({ x0, y0, -1 });
+        polygon.push_back({ x1, y0, -1 });
+        polygon.push_back({ x1, y1, -1 });
+        polygon.push_back({ x0, y1, -1 });
+
+        auto reach = [&]()
+        {
+            double farthest = 0.0;
+            for (auto& corner : polygon)
+            {
+                farthest = std::max(farthest,
+                                    distance(corner.x - px, corner.y - py));
+            }
+            return farthest;
+        };
+
+        //  how far node's sites are at least
+        auto nodeDistance = [&](int node)
+        {
+            const MetricSites::Box& box = sites.treeBoxes[node];
+            const double dx = std::max(box.x0 - px, px - box.x1);
+            const double dy = std::max(box.y0 - py, py - box.y1);
+            return distance(std::max(dx, 0.0), std::max(dy, 0.0));
+        };
+
+        Point points[4];
+        double farthest = reach();
+
+        //  nodes nearest first, so the cell shrinks early and the rest of
+        //  the tree is cut off soon
+        std::vector<TreeRange>& nodes = _nodes;
+        auto farther = [](const TreeRange& a, const TreeRange& b)
+        {
+            return a.distance > b.distance;
+        };
+        auto visit = [&](int node, int begin, int end)
+        {
+            nodes.push_back({ nodeDistance(node), node, begin, end });
+            std::push_heap(nodes.begin(), nodes.end(), farther);
+        };
+        nodes.clear();
+        if (!sites.treeCells.empty())
+            visit(0, 0, (int)sites.treeCells.size());
+        while (!nodes.empty())
+        {
+            std::pop_heap(nodes.begin(), nodes.end(), farther);
+            const TreeRange range = nodes.back();
+            nodes.pop_back();
+            if (range.distance > 2.0 * farthest)
+                break;
+            const int node = range.node;
+            const int begin = range.begin, end = range.end;
+            if (end - begin > metricLeafSites)
+            {
+                const int middle = begin + (end - begin) / 2;
+                visit(2*node + 1, begin, middle);
+                visit(2*node + 2, middle, end);
+                continue;
+            }
+            for (int i = begin; i < end; ++i)
+            {
+                const int other = sites.treeCells[i];
+                const double d = distance(sites.xs[other] - px,
+                                          sites.ys[other] - py);
+                if (other == cell || d == 0.0 || d > 2.0 * farthest)
+                    continue;
+                const int count = bisector(cell, other, points);
+                if (lower(px, py, points, count, other))
+                    farthest = reach();
+            }
+        }
+
+        clip(polygon, _scratch, -1.0, 0.0, 0.0);
+        clip(polygon, _scratch, 1.0, 0.0, sites.xBound);
+        clip(polygon, _scratch, 0.0, -1.0, 0.0);
+        clip(polygon, _scratch, 0.0, 1.0, sites.yBound);
+        simplify(polygon, 1e-12 * (sites.xBound + sites.yBound));
+
+        //  clockwise: side i of the result is side count-2-i reversed
+        const int count = (int)polygon.size();
+        result.resize(count);
+        for (int i = 0; i < count; ++i)
+        {
+            result[i] = polygon[count - 1 - i];
+            result[i].neighbor = polygon[(2*count - 2 - i) % count].neighbor;
+        }
+    }
+
+    //  Where bisectors coincide a cell sees one side along them but not
+    //  which neighbour lies beyond each part of it.  The neighbours' sides
+    //  labelled with the cell claim the parts they lie along; a part
+    //  nothing claims goes to the nearby cell with a side along it.  Sides
+    //  within tolerance of each other count as along one another.
+    static void settlePolygonSides(std::vector<MetricPolygon>& polygons,
+                                   double tolerance)
+    {
+        const int cellCount = (int)polygons.size();
+        auto along = [&polygons, tolerance](int o, double x, double y)
+        {
+            const MetricPolygon& polygon = polygons[o];
+            for (size_t i = 0; i < polygon.size(); ++i)
+            {
+                const MetricCorner& a = polygon[i];
+                const MetricCorner& b = polygon[(i + 1) % polygon.size()];
+                const double dx = b.x - a.x, dy = b.y - a.y;
+                const double lengthSq = dx*dx + dy*dy;
+                if (lengthSq <= tolerance*tolerance)
+                    continue;
+                const double t = (dx*(x-a.x) + dy*(y-a.y)) / lengthSq;
+                const double d = dx*(y-a.y) - dy*(x-a.x);
+                if (t > 0 && t < 1 && d*d <= tolerance*tolerance*lengthSq)
+                    return true;
+            }
+            return false;
+        };
+        auto beyond = [&polygons, &along](int c, int neighbor,
+                                          double x, double y)
+        {
+            if (along(neighbor, x, y))
+                return neighbor;
+            for (const MetricCorner& corner : polygons[c])
+            {
+                if (corner.neighbor >= 0 && corner.neighbor != neighbor &&
+                    along(corner.neighbor, x, y))
+                    return corner.neighbor;
+            }
+            for (const MetricCorner& corner : polygons[c])
+            {
+                if (corner.neighbor < 0)
+                    continue;
+                for (const MetricCorner& next : polygons[corner.neighbor])
+                {
+                    if (next.neighbor >= 0 && next.neighbor != c &&
+                        along(next.neighbor, x, y))
+                        return next.neighbor;
+                }
+            }
+            return neighbor;
+        };
+
+        struct Claim
+        {
+            double x0, y0, x1, y1;
+            int cell;
+        };
+        std::vector<std::vector<Claim>> claims(cellCount);
+        MetricPolygon relabelled;
+        std::vector<std::pair<double, int>> pieces;
+        std::vector<double> cuts;
+        std::vector<MetricPolygon> results(cellCount);
+        //  a part settled by nearness is claimed only in the next pass
+        bool again = true;
+        while (again)
+        {
+            again = false;
+            for (auto& cellClaims : claims)
+                cellClaims.clear();
+            for (int c = 0; c < cellCount; ++c)
+            {
+                const MetricPolygon& polygon = polygons[c];
+                for (size_t i = 0; i < polygon.size(); ++i)
+                {
+                    const MetricCorner& a = polygon[i];
+                    const MetricCorner& b =
+                        polygon[(i + 1) % polygon.size()];
+                    if (a.neighbor >= 0)
+                    {
+                        Claim claim = { a.x, a.y, b.x, b.y, c };
+                        claims[a.neighbor].push_back(claim);
+                    }
+                }
+            }
+
+            for (int c = 0; c < cellCount; ++c)
+            {
+                const MetricPolygon& polygon = polygons[c];
+                bool changed = false;
+                relabelled.clear();
+                for (size_t i = 0; i < polygon.size(); ++i)
+                {
+                    const MetricCorner& a = polygon[i];
+                    const MetricCorner& b =
+                        polygon[(i + 1) % polygon.size()];
+                    relabelled.push_back(a);
+                    const double dx = b.x - a.x, dy = b.y - a.y;
+                    const double length = std::sqrt(dx*dx + dy*dy);
+                    if (a.neighbor < 0 || length <= tolerance)
+                        continue;
+                    const double slack = tolerance / length;
+                    //  claims along this side as (start, end) in [0,1]
+                    pieces.clear();
+                    cuts.assign(1, 0.0);
+                    cuts.push_back(1.0);
+                    for (const Claim& claim : claims[c])
+                    {
+                        const double d0 = (dx*(claim.y0-a.y) -
+                                           dy*(claim.x0-a.x)) / length;
+                        const double d1 = (dx*(claim.y1-a.y) -
+                                           dy*(claim.x1-a.x)) / length;
+                        if (std::abs(d0) > tolerance ||
+                            std::abs(d1) > tolerance)
+                            continue;
+                        double t0 = (dx*(claim.x0-a.x) +
+                                     dy*(claim.y0-a.y)) / (length*length);
+                        double t1 = (dx*(claim.x1-a.x) +
+                                     dy*(claim.y1-a.y)) / (length*length);
+                        if (t0 > t1)
+                            std::swap(t0, t1);
+                        t0 = std::max(t0, 0.0);
+                        t1 = std::min(t1, 1.0);
+                        if (t1 - t0 <= slack)
+                            continue;
+                        pieces.emplace_back(t0, claim.cell);
+                        pieces.emplace_back(t1, claim.cell);
+                        cuts.push_back(t0);
+                        cuts.push_back(t1);
+                    }
+                    if (pieces.size() == 2 &&
+                        pieces[0].second == a.neighbor &&
+                        pieces[0].first <= slack &&
+                        pieces[1].first >= 1 - slack)
+                        continue;
+                    //  split the side where the cell beyond it changes
+                    std::sort(cuts.begin(), cuts.end());
+                    int label = a.neighbor;
+                    for (size_t k = 0; k + 1 < cuts.size(); ++k)
+                    {
+                        if (cuts[k+1] - cuts[k] <= slack)
+                            continue;
+                        const double mid = (cuts[k] + cuts[k+1]) * 0.5;
+                        int claimant = -1;
+                        for (size_t p = 0; p < pieces.size(); p += 2)
+                        {
+                            if (pieces[p].first < mid &&
+                                mid < pieces[p+1].first)
+                            {
+                                claimant = pieces[p].second;
+                                break;
+                            }
+                        }
+                        if (claimant < 0)
+                        {
+                            claimant = beyond(c, a.neighbor,
+                                              a.x + dx*mid, a.y + dy*mid);
+                        }
+                        if (cuts[k] <= slack)
+                        {
+                            if (claimant == a.neighbor)
+                            {
+                                label = claimant;
+                                continue;
+                            }
+                            relabelled.back().neighbor = claimant;
+                        }
+                        else if (claimant != label)
+                        {
+                            MetricCorner corner = { a.x + dx*cuts[k],
+                                                    a.y + dy*cuts[k],
+                                                    claimant };
+                            relabelled.push_back(corner);
+                        }
+                        else
+                            continue;
+                        label = claimant;
+                        changed = true;
+                    }
+                }
+                if (changed)
+                {
+                    results[c].swap(relabelled);
+                    again = true;
+                }
+            }
+            for (int c = 0; c < cellCount; ++c)
+            {
+                if (!results[c].empty())
+                {
+                    polygons[c].swap(results[c]);
+                    results[c].clear();
+                }
+            }
+        }
+    }
+
+    //  Lays the graph out from cell polygons: cell c for site order[c], its polygon clockwise (y up) with each side
+    //  labelled by the cell beyond it, or -1 for the bounds, and half edge
+    //  angles seen from (xs[c], ys[c]).  Both cells of a side take the same
+    //  edges, so the polygons must agree on where the sides run.
+    void Graph::addPolygonCells(const std::vector<int>& order,
+                                std::vector<MetricPolygon>& polygons,
+                                const std::vector<double>& xs,
+                                const std::vector<double>& ys)
+    {
+        const int cellCount = (int)order.size();
+
+        //  point-like sides make no edges; drop them before they split a
+        //  run of sides along one bisector in two
+        for (MetricPolygon& polygon : polygons)
+        {
+            for (size_t i = 0; polygon.size() > 3 && i < polygon.size(); )
+            {
+                const MetricCorner& a = polygon[i];
+                const MetricCorner& b = polygon[(i + 1) % polygon.size()];
+                if (std::abs((float)a.x - (float)b.x) < min_e &&
+                    std::abs((float)a.y - (float)b.y) < min_e)
+                    polygon.erase(polygon.begin() + i);
+                else
+                    ++i;
+            }
+        }
+
+        //  a side's end points, skipping point-like sides as clipEdges does
+        auto sideEnds = [&polygons](int c, size_t i, Vertex& va, Vertex& vb)
+        {
+            const MetricPolygon& polygon = polygons[c];
+            const MetricCorner& a = polygon[i];
+            const MetricCorner& b = polygon[(i + 1) % polygon.size()];
+            va = Vertex((float)a.x, (float)a.y);
+            vb = Vertex((float)b.x, (float)b.y);
+            return std::abs(va.x-vb.x) >= min_e || std::abs(va.y-vb.y) >= min_e;
+        };
+
+        //  A cell's sides come in runs along the same bisector (or the
+        //  bounds).  Sides are counted from the start of a run, firstSide,
+        //  so no run wraps around the end of the polygon.  Cell c's runs
+        //  are runs[runStart[c]] to runs[runStart[c + 1]], each with its
+        //  edges, in order, from runEdges[edgeBegin] to runEdges[edgeEnd]
+        //  (back to front if reversed.)
+        struct Run
+        {
+            int first, last;
+            int neighbor;
+            int edgeBegin, edgeEnd;
+            bool reversed;
+        };
+        size_t sideCount = 0;
+        for (const MetricPolygon& polygon : polygons)
+            sideCount += polygon.size();
+        std::vector<Run> runs;
+        runs.reserve(sideCount);
+        std::vector<int> runStart(cellCount + 1, 0);
+        std::vector<int> firstSide(cellCount, 0);
+        std::vector<char> linked(cellCount, 0);
+        for (int c = 0; c < cellCount; ++c)
+        {
+            const MetricPolygon& polygon = polygons[c];
+            const int count = (int)polygon.size();
+            runStart[c] = (int)runs.size();
+            int& first = firstSide[c];
+            while (first < count &&
+                   polygon[first].neighbor ==
+                   polygon[(first + count - 1) % count].neighbor)
+                ++first;
+            if (first == count)
+                first = 0;
+            for (int k = 0; k < count; ++k)
+            {
+                const int neighbor = polygon[(first + k) % count].neighbor;
+                if (neighbor >= 0)
+                    linked[c] = 1;
+                if ((int)runs.size() == runStart[c] ||
+                    runs.back().neighbor != neighbor)
+                {
+                    Run run = { k, k, neighbor, 0, 0, false };
+                    runs.push_back(run);
+                }
+                else
+                    runs.back().last = k;
+            }
+        }
+        runStart[cellCount] = (int)runs.size();
+
+        Cells& cells = _cells;
+        Edges& edges = _edges;
+        cells.reserve(cellCount);
+        edges.reserve(edges.size() + sideCount / 2 + cellCount);
+        std::vector<int> runEdges;
+        runEdges.reserve(sideCount);
+
+        //  edges between cells, one per side, owned by the lower numbered
+        //  cell; the other cell takes an owner's run back to front, the one
+        //  whose ends are nearest its own run's, rather than its own sides,
+        //  so both cells see the same edges.  Then the border edges in the
+        //  order closeCells adds them.
+        for (int c = 0; c < cellCount; ++c)
+        {
+            cells.emplace_back(order[c]);
+            siteCellRef(order[c]) = c;
+            const MetricPolygon& polygon = polygons[c];
+            Vertex va, vb;
+            for (int r = runStart[c]; r < runStart[c + 1]; ++r)
+            {
+                Run& run = runs[r];
+                if (run.neighbor <= c)
+                    continue;
+                run.edgeBegin = (int)runEdges.size();
+                for (int k = run.first; k <= run.last; ++k)
+                {
+                    const size_t i = (firstSide[c] + k) % polygon.size();
+                    if (!sideEnds(c, i, va, vb))
+                        continue;
+                    edges.emplace_back(order[c], order[run.neighbor]);
+                    edges.back().p0 = va;
+                    edges.back().p1 = vb;
+                    runEdges.push_back((int)edges.size()-1);
+                }
+                run.edgeEnd = (int)runEdges.size();
+            }
+        }
+        auto runEnds = [&polygons, &firstSide](int c, const Run& run,
+                                               Vertex& va, Vertex& vb)
+        {
+            const MetricPolygon& polygon = polygons[c];
+            const MetricCorner& a = polygon[(firstSide[c] + run.first) %
+                                            polygon.size()];
+            const MetricCorner& b = polygon[(firstSide[c] + run.last + 1) %
+                                            polygon.size()];
+            va = Vertex((float)a.x, (float)a.y);
+            vb = Vertex((float)b.x, (float)b.y);
+        };
+        std::vector<char> claimed(runs.size(), 0);
+        for (int c = 0; c < cellCount; ++c)
+        {
+            const MetricPolygon& polygon = polygons[c];
+            for (int r = runStart[c]; r < runStart[c + 1]; ++r)
+            {
+                Run& run = runs[r];
+                const int neighbor = run.neighbor;
+                if (neighbor < 0 || neighbor > c)
+                    continue;
+                Vertex va, vb, ownerA, ownerB;
+                runEnds(c, run, va, vb);
+                int best = -1;
+                float bestDistance = std::numeric_limits<float>::max();
+                for (int o = runStart[neighbor]; o < runStart[neighbor + 1];
+                     ++o)
+                {
+                    const Run& ownerRun = runs[o];
+                    if (ownerRun.neighbor != c || claimed[o])
+                        continue;
+                    runEnds(neighbor, ownerRun, ownerA, ownerB);
+                    const float d = std::abs(ownerA.x - vb.x) +
+                                    std::abs(ownerA.y - vb.y) +
+                                    std::abs(ownerB.x - va.x) +
+                                    std::abs(ownerB.y - va.y);
+                    if (d < bestDistance)
+                    {
+                        bestDistance = d;
+                        best = o;
+                    }
+                }
+                if (best >= 0)
+                {
+                    claimed[best] = 1;
+                    run.edgeBegin = runs[best].edgeBegin;
+                    run.edgeEnd = runs[best].edgeEnd;
+                    run.reversed = true;
+                    continue;
+                }
+                //  the owner saw no such run; this cell's sides stand
+                run.edgeBegin = (int)runEdges.size();
+                for (int k = run.first; k <= run.last; ++k)
+                {
+                    const size_t i = (firstSide[c] + k) % polygon.size();
+                    if (!sideEnds(c, i, va, vb))
+                        continue;
+                    edges.emplace_back(order[neighbor], order[c]);
+                    edges.back().p0 = vb;
+                    edges.back().p1 = va;
+                    runEdges.push_back((int)edges.size()-1);
+                }
+                run.edgeEnd = (int)runEdges.size();
+            }
+        }
+        for (int c = cellCount; c--; )
+        {
+            if (!linked[c])
+                continue;
+            const MetricPolygon& polygon = polygons[c];
+            Vertex va, vb;
+            for (int r = runStart[c]; r < runStart[c + 1]; ++r)
+            {
+                Run& run = runs[r];
+                if (run.neighbor >= 0)
+                    continue;
+                run.edgeBegin = (int)runEdges.size();
+                for (int k = run.first; k <= run.last; ++k)
+                {
+                    const size_t i = (firstSide[c] + k) % polygon.size();
+                    if (sideEnds(c, i, va, vb))
+                    {
+                        runEdges.push_back(
+                            createBorderEdge(order[c], va, vb));
+                    }
+                }
+                run.edgeEnd = (int)runEdges.size();
+            }
+        }
+
+        //  half edges clockwise, from the one with the largest angle
+        for (int c = 0; c < cellCount; ++c)
+        {
+            if (!linked[c])
+                continue;
+            HalfEdges& halfEdges = cells[c].halfEdges;
+            size_t first = 0;
+            size_t edgeCount = 0;
+            for (int r = runStart[c]; r < runStart[c + 1]; ++r)
+                edgeCount += runs[r].edgeEnd - runs[r].edgeBegin;
+            halfEdges.reserve(edgeCount);
+            for (int r = runStart[c]; r < runStart[c + 1]; ++r)
+            {
+                const Run& run = runs[r];
+                for (int e = run.edgeBegin; e < run.edgeEnd; ++e)
+                {
+                    HalfEdge halfEdge;
+                    halfEdge.edge = run.reversed ?
+                        runEdges[run.edgeBegin + run.edgeEnd - 1 - e] :
+                        runEdges[e];
+                    halfEdge.site = order[c];
+                    const Vertex va = getHalfEdgeStartpoint(halfEdge);
+                    const Vertex vb = getHalfEdgeEndpoint(halfEdge);
+                    halfEdge.angle = halfEdgeAngle(
+                        (float)((va.y + vb.y) * 0.5 - ys[c]),
+                        (float)((va.x + vb.x) * 0.5 - xs[c]));
+                    if (!halfEdges.empty() &&
+                        halfEdge.angle > halfEdges[first].angle)
+                        first = halfEdges.size();
+                    halfEdges.push_back(halfEdge);
+                }
+            }
+            std::rotate(halfEdges.begin(), halfEdges.begin() + first,
+                        halfEdges.end());
+        }
+
+        if (_options.cellMetrics)
+        {
+            _cellMetrics.resize(cellCount);
+            for (int c = 0; c < cellCount; ++c)
+                measureCell(c);
+        }
+
+        if (_options.topology)
+            linkHalfEdges();
+
+        if (_options.compact)
+            compact();
+    }
+
+    //  Builds the graph of sites under metric, Manhattan or Chebyshev
+    //  distance (a Euclidean metric goes to build().)  See above.
+    Graph buildMetric(Sites&& sites, float xBound, float yBound,
+                      Metric metric, const BuildOptions& options)
+    {
+        if (metric == Metric::Euclidean)
+            return build(std::move(sites), xBound, yBound, options);
+
+        Graph graph(xBound, yBound, std::move(sites), options);
+        graph._nearestSiteCells = false;
+        const int siteCount = (int)graph._siteCount;
+
+        //  sweep order, the first of any repeated site taking the cell
+        std::vector<int> order(siteCount);
+        for (int i = 0; i < siteCount; ++i)
+            order[i] = i;
+        std::sort(order.begin(), order.end(), [&graph](int site1, int site2)
+        {
+            const Vertex r1 = graph.sitePosition(site1);
+            const Vertex r2 = graph.sitePosition(site2);
+            return r2.y > r1.y || (r2.y == r1.y && r2.x > r1.x) ||
+                   (r2 == r1 && site2 > site1);
+        });
+        order.erase(std::unique(order.begin(), order.end(),
+                                [&graph](int site1, int site2)
+                                {
+                                    return graph.sitePosition(site1) ==
+                                           graph.sitePosition(site2);
+                                }),
+                    order.end());
+        const int cellCount = (int)order.size();
+        std::vector<double> xs(cellCount), ys(cellCount);
+        for (int c = 0; c < cellCount; ++c)
+        {
+            const Vertex site = graph.sitePosition(order[c]);
+            xs[c] = site.x;
+            ys[c] = site.y;
+        }
+
+        std::vector<MetricPolygon> polygons(cellCount);
+        {
+            const MetricSites metricSites(metric, xs, ys, xBound, yBound);
+            const unsigned threadCount = std::max(1u,
+                std::min<unsigned>(options.finalizeThreads,
+                                   (unsigned)std::max(cellCount, 1)));
+            parallelFor(threadCount, [&](unsigned thread)
+            {
+                MetricCells cells(metricSites);
+                const int begin = (int)((size_t)cellCount * thread /
+                                        threadCount);
+                const int end = (int)((size_t)cellCount * (thread + 1) /
+                                      threadCount);
+                for (int c = begin; c < end; ++c)
+                    cells.cell(c, polygons[c]);
+            });
+        }
+
+        settlePolygonSides(polygons, 1e-9 * ((double)xBound + yBound));
+
+        graph.addPolygonCells(order, polygons, xs, ys);
+        return graph;
+    }
+
+    ///////////////////////////////////////////////////////////////////////////
+    //  Farthest point graphs
+    //
+    //  A site's farthest point cell is where no site is further away.  Only
+    //  the corners of the sites' convex hull have one, and the cells follow
+    //  from the hull alone.  Its farthest point Delaunay triangulation is
+    //  found by cutting corners off the hull polygon, each time the one
+    //  whose circle through it and its two neighbours is largest, as that
+    //  circle holds every other corner (Skyum's lemma); with a heap of the
+    //  corners' circles that is O(h log h) for h corners.  A corner's cell
+    //  is bounded by the centres of the circles of its triangles, in order
+    //  around it, and two rays along its bisectors with its neighbours on
+    //  the hull, running into the hull (the far side of the sites from
+    //  it); the rays are cut off well outside the bounds and the polygon
+    //  clipped to them.
+    //
+    //  The graph is laid out as a metric graph is: cells for the hull's
+    //  corners in sweep order (other sites get no cell), each edge between
+    //  the two sites farthest along it.  A site lies outside its cell, so a
+    //  half edge's angle is seen from the middle of the cell's corners
+    //  rather than from the site.  A single site gets a cell without edges,
+    //  as build gives it; of collinear sites only the two ends have cells,
+    //  each the half of the bounds on the far side of their bisector.
+    //  metric, robustness, beachlineSearch and periodic don't apply.
+
+    //  centre and squared radius of the circle through a, b and c
+    static void farthestCircle(const Vertex& a, const Vertex& b,
+                               const Vertex& c, double& x, double& y,
+                               double& r2)
+    {
+        const double bx = (double)b.x - a.x, by = (double)b.y - a.y;
+        const double cx = (double)c.x - a.x, cy = (double)c.y - a.y;
+        const double d = 2.0 * (bx*cy - by*cx);
+        const double b2 = bx*bx + by*by, c2 = cx*cx + cy*cy;
+        const double ux = (cy*b2 - by*c2) / d;
+        const double uy = (bx*c2 - cx*b2) / d;
+        x = a.x + ux;
+        y = a.y + uy;
+        r2 = ux*ux + uy*uy;
+    }
+
+    //  Builds the farthest point graph of sites, its cells the parts of the
+    //  bounds where each site of the convex hull is the farthest.  See above.
+    Graph buildFarthest(Sites&& sites, float xBound, float yBound,
+                        const BuildOptions& options)
+    {
+        Graph graph(xBound, yBound, std::move(sites), options);
+        graph._nearestSiteCells = false;
+        const int siteCount = (int)graph._siteCount;
+
+        //  sweep order, the first of any repeated site kept
+        std::vector<int> order(siteCount);
+        for (int i = 0; i < siteCount; ++i)
+            order[i] = i;
+        std::sort(order.begin(), order.end(), [&graph](int site1, int site2)
+        {
+            const Vertex r1 = graph.sitePosition(site1);
+            const Vertex r2 = graph.sitePosition(site2);
+            return r2.y > r1.y || (r2.y == r1.y && r2.x > r1.x) ||
+                   (r2 == r1 && site2 > site1);
+        });
+        order.erase(std::unique(order.begin(), order.end(),
+                                [&graph](int site1, int site2)
+                                {
+                                    return graph.sitePosition(site1) ==
+                                           graph.sitePosition(site2);
+                                }),
+                    order.end());
+
+        //  the hull counterclockwise, without corners on its sides; sweep
+        //  order is sorted by y then x, which serves the monotone chain
+        //  as well as x then y
+        auto turn = [&graph](int o, int a, int b)
+        {
+            const Vertex vo = graph.sitePosition(o);
+            const Vertex va = graph.sitePosition(a);
+            const Vertex vb = graph.sitePosition(b);
+            return ((double)va.x - vo.x) * ((double)vb.y - vo.y) -
+                   ((double)va.y - vo.y) * ((double)vb.x - vo.x);
+        };
+        std::vector<int> hull;
+        if (order.size() < 3)
+            hull = order;
+        else
+        {
+            hull.resize(2 * order.size());
+            size_t k = 0;
+            for (size_t i = 0; i < order.size(); ++i)
+            {
+                while (k >= 2 && turn(hull[k-2], hull[k-1], order[i]) <= 0.0)
+                    --k;
+                hull[k++] = order[i];
+            }
+            for (size_t i = order.size() - 1, lower = k + 1; i-- > 0; )
+            {
+                while (k >= lower &&
+                       turn(hull[k-2], hull[k-1], order[i]) <= 0.0)
+                    --k;
+                hull[k++] = order[i];
+            }
+            hull.resize(k - 1);
+        }
+        const int h = (int)hull.size();
+        auto corner = [&graph, &hull](int i)
+        {
+            return graph.sitePosition(hull[i]);
+        };
+
+        std::vector<MetricPolygon> polygons(h);
+        MetricPolygon scratch;
+        const MetricPolygon bounds = {
+            { 0.0, 0.0, -1 }, { xBound, 0.0, -1 },
+            { xBound, yBound, -1 }, { 0.0, yBound, -1 }
+        };
+        if (h <= 2)
+        {
+            for (int i = 0; i < h; ++i)
+            {
+                polygons[i] = bounds;
+                if (h < 2)
+                    continue;
+                //  |x - a| >= |x - b|, as (a - b).x <= (|a|^2 - |b|^2) / 2
+                const Vertex a = corner(i), b = corner(1 - i);
+                MetricCells::clip(polygons[i], scratch,
+                                  (double)a.x - b.x, (double)a.y - b.y,
+                                  ((double)a.x*a.x + (double)a.y*a.y -
+                                   (double)b.x*b.x - (double)b.y*b.y) * 0.5,
+                                  1 - i);
+            }
+        }
+        else
+        {
+            //  the triangulation, cutting off the corner with the largest
+            //  circle (found stale, and skipped, if a neighbour has gone
+            //  since it was queued)
+            struct Triangle
+            {
+                int corners[3];
+                double x, y;
+            };
+            struct Queued
+            {
+                double r2;
+                int corner, stamp;
+                bool operator<(const Queued& other) const
+                {
+                    return r2 < other.r2;
+                }
+            };
+            std::vector<Triangle> triangles;
+            triangles.reserve(h - 2);
+            std::vector<int> prev(h), next(h), stamps(h, 0);
+            std::priority_queue<Queued> queue;
+            auto enqueue = [&](int i)
+            {
+                double x, y, r2;
+                farthestCircle(corner(prev[i]), corner(i), corner(next[i]),
+                               x, y, r2);
+                Queued queued = { r2, i, ++stamps[i] };
+                queue.push(queued);
+            };
+            auto cut = [&](int i)
+            {
+                Triangle triangle = { { prev[i], i, next[i] }, 0.0, 0.0 };
+                double r2;
+                farthestCircle(corner(prev[i]), corner(i), corner(next[i]),
+                               triangle.x, triangle.y, r2);
+                triangles.push_back(triangle);
+            };
+            for (int i = 0; i < h; ++i)
+            {
+                prev[i] = (i + h - 1) % h;
+                next[i] = (i + 1) % h;
+            }
+            for (int i = 0; i < h; ++i)
+                enqueue(i);
+            for (int left = h; left > 3; --left)
+            {
+                Queued top = queue.top();
+                queue.pop();
+                while (top.stamp != stamps[top.corner])
+                {
+                    top = queue.top();
+                    queue.pop();
+                }
+                const int i = top.corner;
+                cut(i);
+                stamps[i] = -1;
+                next[prev[i]] = next[i];
+                prev[next[i]] = prev[i];
+                enqueue(prev[i]);
+                enqueue(next[i]);
+            }
+            for (int i = 0; i < h; ++i)
+            {
+                if (stamps[i] >= 0)
+                {
+                    cut(i);
+                    break;
+                }
+            }
+
+            //  each corner's triangles in order around it, from the one
+            //  with its next corner on the hull to the one with its
+            //  previous; keyed by how far round the hull their nearer
+            //  other corner is
+            std::vector<std::vector<std::pair<int, int>>> fans(h);
+            for (int t = 0; t < (int)triangles.size(); ++t)
+            {
+                for (int j = 0; j < 3; ++j)
+                {
+                    const int i = triangles[t].corners[j];
+                    const int a = triangles[t].corners[(j + 1) % 3];
+                    const int b = triangles[t].corners[(j + 2) % 3];
+                    const int key = std::min((a - i + h) % h, (b - i + h) % h);
+                    fans[i].emplace_back(key, t);
+                }
+            }
+
+            //  rays are cut off at 'far', further from the origin than the
+            //  bounds and every circle's centre
+            double reach = std::max((double)xBound, (double)yBound);
+            for (const Triangle& triangle : triangles)
+            {
+                reach = std::max(reach, std::max(std::abs(triangle.x),
+                                                 std::abs(triangle.y)));
+            }
+            const double far = 4.0 * (2.0 * reach + 1.0);
+            //  the unit normal into the hull from the side from corner a to
+            //  corner b
+            auto inward = [&corner](int a, int b, double& nx, double& ny)
+            {
+                const Vertex va = corner(a), vb = corner(b);
+                const double dx = (double)vb.x - va.x;
+                const double dy = (double)vb.y - va.y;
+                const double length = std::sqrt(dx*dx + dy*dy);
+                nx = -dy / length;
+                ny = dx / length;
+            };
+            for (int i = 0; i < h; ++i)
+            {
+                std::vector<std::pair<int, int>>& fan = fans[i];
+                std::sort(fan.begin(), fan.end());
+                //  the other corner of each side from the circle centres
+                //  out: the next corner, those shared by adjacent
+                //  triangles, the previous corner
+                double nx0, ny0, nx1, ny1;
+                inward(i, (i + 1) % h, nx0, ny0);
+                inward((i + h - 1) % h, i, nx1, ny1);
+                const Triangle& first = triangles[fan.front().second];
+                const Triangle& last = triangles[fan.back().second];
+                double ux = nx0 + nx1, uy = ny0 + ny1;
+                const double u = std::sqrt(ux*ux + uy*uy);
+                ux /= u;
+                uy /= u;
+
+                MetricPolygon& polygon = polygons[i];
+                polygon.push_back({ first.x + far*nx0, first.y + far*ny0,
+                                    (i + 1) % h });
+                for (size_t j = 0; j < fan.size(); ++j)
+                {
+                    const Triangle& triangle = triangles[fan[j].second];
+                    const int shared = j + 1 < fan.size() ?
+                                       (i + fan[j+1].first) % h :
+                                       (i + h - 1) % h;
+                    polygon.push_back({ triangle.x, triangle.y, shared });
+                }
+                const double x1 = last.x + far*nx1, y1 = last.y + far*ny1;
+                const double x0 = first.x + far*nx0, y0 = first.y + far*ny0;
+                polygon.push_back({ x1, y1, -1 });
+                polygon.push_back({ x1 + far*ux, y1 + far*uy, -1 });
+                polygon.push_back({ x0 + far*ux, y0 + far*uy, -1 });
+
+                MetricCells::clip(polygon, scratch, -1.0, 0.0, 0.0);
+                MetricCells::clip(polygon, scratch, 1.0, 0.0, xBound);
+                MetricCells::clip(polygon, scratch, 0.0, -1.0, 0.0);
+                MetricCells::clip(polygon, scratch, 0.0, 1.0, yBound);
+            }
+        }
+
+        //  cells for the hull's corners in sweep order, polygons clockwise
+        //  and labelled by cell, angles seen from the middle of each
+        std::vector<int> cellOf(h);
+        for (int i = 0; i < h; ++i)
+            cellOf[i] = i;
+        std::sort(cellOf.begin(), cellOf.end(), [&graph, &hull](int a, int b)
+        {
+            const Vertex r1 = graph.sitePosition(hull[a]);
+            const Vertex r2 = graph.sitePosition(hull[b]);
+            return r2.y > r1.y || (r2.y == r1.y && r2.x > r1.x);
+        });
+        std::vector<int> cellOrder(h), cellIndex(h);
+        std::vector<MetricPolygon> cellPolygons(h);
+        std::vector<double> xs(h, 0.0), ys(h, 0.0);
+        for (int c = 0; c < h; ++c)
+        {
+            cellOrder[c] = hull[cellOf[c]];
+            cellIndex[cellOf[c]] = c;
+        }
+        for (int c = 0; c < h; ++c)
+        {
+            const MetricPolygon& polygon = polygons[cellOf[c]];
+            MetricPolygon& result = cellPolygons[c];
+            const int count = (int)polygon.size();
+            double area2 = 0.0;
+            for (int k = 0; k < count; ++k)
+            {
+                const MetricCorner& a = polygon[k];
+                const MetricCorner& b = polygon[(k + 1) % count];
+                area2 += a.x*b.y - b.x*a.y;
+                xs[c] += a.x / count;
+                ys[c] += a.y / count;
+            }
+            result.resize(count);
+            for (int k = 0; k < count; ++k)
+            {
+                //  counterclockwise ones reversed, side k of the result
+                //  being side count-2-k
+                result[k] = area2 > 0.0 ? polygon[count - 1 - k] :
+                                          polygon[k];
+                const int neighbor = area2 > 0.0 ?
+                    polygon[(2*count - 2 - k) % count].neighbor :
+                    polygon[k].neighbor;
+                result[k].neighbor = neighbor < 0 ? -1 : cellIndex[neighbor];
+            }
+        }
+        graph.addPolygonCells(cellOrder, cellPolygons, xs, ys);
+        return graph;
+    }
+
+    ///////////////////////////////////////////////////////////////////////////
+    //  Window graphs
+    //
+    //  The cells within a window W are found from the sites within a guard
+    //  distance r of it (in the rectangle W widened by r on each side.)  A
+    //  site beyond that rectangle is further than r from every point of W,
+    //  so wherever a point of W lies within r of the site whose cell holds
+    //  it, no site left out is nearer: the cell is exact there.  Cells are
+    //  convex, so it is enough that each cell's corners, clipped to W, lie
+    //  within r of its site.  Leaving sites out only makes cells larger, so
+    //  if a corner lies further out, r grown to the furthest corner's
+    //  distance settles every cell on the next pass: whatever point of W
+    //  the cell of a site added then holds, it is nearer to it than the
+    //  site it was with.  The first pass tries r of two buckets.
+    //
+    //  The graph's bounds are the window, with coordinates taken from its
+    //  lower left corner (minX, minY), and its sites are those near the
+    //  window, siteSources() telling which of the given sites each is.
+    //  Sites whose cells miss the window have no half edges.  periodic
+    //  doesn't apply.
+
+    SiteBuckets::SiteBuckets(const Sites& sites) :
+        _sites(sites),
+        _x0(0.0f), _y0(0.0f), _size(1.0f),
+        _columns(1), _rows(1)
+    {
+        const int count = (int)sites.size();
+        float x1 = 0.0f, y1 = 0.0f;
+        if (count)
+        {
+            _x0 = x1 = sites[0].x;
+            _y0 = y1 = sites[0].y;
+        }
+        for (const Site& site : sites)
+        {
+            _x0 = std::min(_x0, site.x);
+            _y0 = std::min(_y0, site.y);
+            x1 = std::max(x1, site.x);
+            y1 = std::max(y1, site.y);
+        }
+        const double width = (double)x1 - _x0, height = (double)y1 - _y0;
+        double size = std::sqrt(std::max(width * height, 1e-12) * 2.0 /
+                                std::max(count, 1));
+        _columns = std::min((int)(width / size) + 1, 4096);
+        _rows = std::min((int)(height / size) + 1, 4096);
+        size = std::max(size, std::max(width / _columns, height / _rows));
+        _size = (float)size;
+
+        //  counted, summed and filled, row by row
+        auto bucket = [this](const Site& site)
+        {
+            const int column = std::min((int)((site.x - _x0) / _size),
+                                        _columns - 1);
+            const int row = std::min((int)((site.y - _y0) / _size),
+                                     _rows - 1);
+            return row * _columns + column;
+        };
+        _bucketStart.assign((size_t)_columns * _rows + 1, 0);
+        for (const Site& site : sites)
+            ++_bucketStart[bucket(site) + 1];
+        for (size_t b = 1; b < _bucketStart.size(); ++b)
+            _bucketStart[b] += _bucketStart[b - 1];
+        _bucketSites.resize(count);
+        std::vector<int> fill(_bucketStart.begin(), _bucketStart.end() - 1);
+        for (int i = 0; i < count; ++i)
+            _bucketSites[fill[bucket(sites[i])]++] = i;
+    }
+
+    void SiteBuckets::sitesInRect(float minX, float minY,
+                                  float maxX, float maxY,
+                                  std::vector<int>& found) const
+    {
+        if (_sites.empty() || maxX < minX || maxY < minY)
+            return;
+        auto clamp = [](double value, int limit)
+        {
+            return (int)std::max(0.0, std::min(value, (double)limit - 1));
+        };
+        const int column0 = clamp(std::floor((minX - _x0) / _size), _columns);
+        const int column1 = clamp(std::floor((maxX - _x0) / _size), _columns);
+        const int row0 = clamp(std::floor((minY - _y0) / _size), _rows);
+        const int row1 = clamp(std::floor((maxY - _y0) / _size), _rows);
+        for (int row = row0; row <= row1; ++row)
+        {
+            const int first = _bucketStart[row * _columns + column0];
+            const int last = _bucketStart[row * _columns + column1 + 1];
+            for (int i = first; i < last; ++i)
+            {
+                const Site& site = _sites[_bucketSites[i]];
+                if (minX <= site.x && site.x <= maxX &&
+                    minY <= site.y && site.y <= maxY)
+                    found.push_back(_bucketSites[i]);
+            }
+        }
+    }
+
+    //  Builds the cells of the sites within [minX, maxX] x [minY, maxY],
+    //  exact there, from the sites within a guard distance of it.  See
+    //  above.
+    Graph buildWindow(const SiteBuckets& sites, float minX, float minY,
+                      float maxX, float maxY, const BuildOptions& options)
+    {
+        const Sites& given = sites.sites();
+        const float width = std::max(maxX - minX, 0.0f);
+        const float height = std::max(maxY - minY, 0.0f);
+        BuildOptions windowOptions = options;
+        windowOptions.periodic = false;
+        BuildOptions sweepOptions = windowOptions;
+        sweepOptions.cellMetrics = false;
+        sweepOptions.topology = false;
+        sweepOptions.compact = false;
+
+        Graph graph;
+        std::vector<int> local;
+        double guard = 2.0 * sites.bucketSize();
+        for (;;)
+        {
+            local.clear();
+            sites.sitesInRect((float)(minX - guard), (float)(minY - guard),
+                              (float)(maxX + guard), (float)(maxY + guard),
+                              local);
+            const bool everything = local.size() == given.size();
+            if (local.empty() && !everything)
+            {
+                guard *= 2.0;
+                continue;
+            }
+            std::sort(local.begin(), local.end());
+
+            //  build() wants its sites within its bounds, so the sweep
+            //  runs over the window grown to hold every local site, and
+            //  its cells are clipped to the window
+            double x0 = minX, y0 = minY, x1 = maxX, y1 = maxY;
+            for (int site : local)
+            {
+                x0 = std::min(x0, (double)given[site].x);
+                y0 = std::min(y0, (double)given[site].y);
+                x1 = std::max(x1, (double)given[site].x);
+                y1 = std::max(y1, (double)given[site].y);
+            }
+            Sites sweepSites, windowSites;
+            sweepSites.reserve(local.size());
+            windowSites.reserve(local.size());
+            for (int site : local)
+            {
+                sweepSites.emplace_back(Vertex(given[site].x - x0,
+                                               given[site].y - y0));
+                windowSites.emplace_back(Vertex(given[site].x - minX,
+                                                given[site].y - minY));
+            }
+            const Graph swept = build(std::move(sweepSites),
+                                      (float)(x1 - x0), (float)(y1 - y0),
+                                      sweepOptions);
+
+            const int cellCount = (int)swept.cells().size();
+            const double dx = x0 - minX, dy = y0 - minY;
+            std::vector<int> order(cellCount);
+            std::vector<MetricPolygon> polygons(cellCount);
+            std::vector<double> xs(cellCount), ys(cellCount);
+            MetricPolygon scratch;
+            for (int c = 0; c < cellCount; ++c)
+            {
+                const Cell& cell = swept.cells()[c];
+                const Vertex site = swept.sitePosition(cell.site);
+                order[c] = cell.site;
+                xs[c] = site.x + dx;
+                ys[c] = site.y + dy;
+                MetricPolygon& polygon = polygons[c];
+                for (const HalfEdge& halfEdge : cell.halfEdges)
+                {
+                    const Edge& edge = swept.edges()[halfEdge.edge];
+                    const int other = edge.leftSite == cell.site ?
+                                      edge.rightSite : edge.leftSite;
+                    const Vertex v = swept.getHalfEdgeStartpoint(halfEdge);
+                    const MetricCorner corner = {
+                        v.x + dx, v.y + dy,
+                        other < 0 ? -1 : swept.siteCell(other)
+                    };
+                    polygon.push_back(corner);
+                }
+                MetricCells::clip(polygon, scratch, -1.0, 0.0, 0.0);
+                MetricCells::clip(polygon, scratch, 1.0, 0.0, width);
+                MetricCells::clip(polygon, scratch, 0.0, -1.0, 0.0);
+                MetricCells::clip(polygon, scratch, 0.0, 1.0, height);
+            }
+            graph = Graph(width, height, std::move(windowSites),
+                          windowOptions);
+            graph.addPolygonCells(order, polygons, xs, ys);
+
+            //  no edge crosses the window, so it lies in the cell of the
+            //  site nearest its centre; keep that site alone, the way a
+            //  lone site builds
+            if (local.size() > 1 &&
+                std::all_of(graph.cells().begin(), graph.cells().end(),
+                            [](const Cell& cell)
+                            {
+                                return cell.halfEdges.empty();
+                            }))
+            {
+                const double cx = 0.5 * (minX + maxX);
+                const double cy = 0.5 * (minY + maxY);
+                auto distance = [&given, cx, cy](int site)
+                {
+                    const double dx = given[site].x - cx;
+                    const double dy = given[site].y - cy;
+                    return dx*dx + dy*dy;
+                };
+                const int nearest = *std::min_element(local.begin(),
+                    local.end(),
+                    [&distance](int a, int b)
+                    {
+                        return distance(a) < distance(b);
+                    });
+                local.assign(1, nearest);
+                windowSites.assign(1, Vertex(given[nearest].x - minX,
+                                             given[nearest].y - minY));
+                graph = build(std::move(windowSites), width, height,
+                              windowOptions);
+            }
+            if (everything)
+                break;
+
+            //  how far the cells reach from their sites; a lone site's
+            //  cell is the window, without edges
+            double reach = 0.0;
+            auto stretch = [&reach](const Vertex& site, const Vertex& v)
+            {
+                const double dx = (double)v.x - site.x;
+                const double dy = (double)v.y - site.y;
+                reach = std::max(reach, std::sqrt(dx*dx + dy*dy));
+            };
+            for (const Cell& cell : graph.cells())
+            {
+                const Vertex site = graph.sitePosition(cell.site);
+                if (cell.halfEdges.empty() && graph.cells().size() == 1)
+                {
+                    stretch(site, Vertex(0.0f, 0.0f));
+                    stretch(site, Vertex(width, 0.0f));
+                    stretch(site, Vertex(0.0f, height));
+                    stretch(site, Vertex(width, height));
+                }
+                for (const HalfEdge& halfEdge : cell.halfEdges)
+                {
+                    stretch(site, graph.getHalfEdgeStartpoint(halfEdge));
+                    stretch(site, graph.getHalfEdgeEndpoint(halfEdge));
+                }
+            }
+            if (reach <= guard)
+                break;
+            guard = std::max(reach * (1.0 + 1e-6), guard * 1.001);
+        }
+        graph._siteSources.swap(local);
+        return graph;
+    }
+
     }   // namespace voronoi
 }   // namespace cinekine
 
-#endif
\ No newline at end of file
+#endif